@@ -0,0 +1,113 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../blend.h"
+
+#define ITERATIONS 1000000
+#define CHECK_ROWS 10000
+// the default bar width, which is as wide as a blended row gets with it
+#define ROW_WIDTH 75
+
+#define true 1
+#define false 0
+
+/*
+ * Microbenchmark for the MIT-SHM backend's blend kernels,
+ * which also checks that every kernel matches the scalar one
+ * usage: blend-bench
+ */
+
+typedef void (*sb_blend_row_t)(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+
+// keeps the compiler from throwing the blended rows away
+volatile uint32_t sink;
+
+double sb_elapsed_ns(const struct timespec *start, const struct timespec *end) {
+        return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * Coverage like a glyph's: mostly empty or solid, antialiased in between
+ */
+void sb_random_mask(uint8_t *mask, int n) {
+        for (int i = 0; i < n; i++) {
+                int r = rand() % 4;
+                mask[i] = r == 0 ? 0 : r == 1 ? 255 : rand() % 256;
+        }
+}
+
+void sb_random_row(uint32_t *row, int n) {
+        for (int i = 0; i < n; i++)
+                row[i] = (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+/*
+ * Blends random rows of every length up to ROW_WIDTH with blend and
+ * with the scalar kernel
+ * Returns false if they ever disagree
+ */
+int sb_check(const char *name, sb_blend_row_t blend) {
+        uint32_t expected[ROW_WIDTH], actual[ROW_WIDTH], color;
+        uint8_t mask[ROW_WIDTH];
+
+        for (int i = 0; i < CHECK_ROWS; i++) {
+                int n = i % (ROW_WIDTH + 1);
+
+                sb_random_row(expected, ROW_WIDTH);
+                sb_random_mask(mask, ROW_WIDTH);
+                sb_random_row(&color, 1);
+                memcpy(actual, expected, sizeof actual);
+
+                sb_blend_row_scalar(expected, mask, n, color);
+                blend(actual, mask, n, color);
+                if (memcmp(expected, actual, sizeof actual) != 0) {
+                        fprintf(stderr, "%s differs from scalar at n = %d\n", name, n);
+                        return false;
+                }
+        }
+        return true;
+}
+
+void sb_bench(const char *name, sb_blend_row_t blend) {
+        uint32_t row[ROW_WIDTH], color = 0xFFB4BE82;
+        uint8_t mask[ROW_WIDTH];
+        struct timespec start, end;
+
+        sb_random_row(row, ROW_WIDTH);
+        sb_random_mask(mask, ROW_WIDTH);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ITERATIONS; i++) {
+                blend(row, mask, ROW_WIDTH, color);
+                sink = row[i % ROW_WIDTH];
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-32s %8.1f ns\n", name, sb_elapsed_ns(&start, &end) / ITERATIONS);
+}
+
+int main(void) {
+        const struct { const char *name; sb_blend_row_t blend; int supported; } kernels[] = {
+                { "sb_blend_row_scalar", sb_blend_row_scalar, true },
+#ifdef SB_HAVE_X86_SIMD
+                { "sb_blend_row_sse2", sb_blend_row_sse2, __builtin_cpu_supports("sse2") },
+                { "sb_blend_row_avx2", sb_blend_row_avx2, __builtin_cpu_supports("avx2") },
+#endif
+        };
+        int ok = true;
+
+        srand(1);
+        printf("%d pixel row\n", ROW_WIDTH);
+        for (size_t i = 0; i < sizeof kernels / sizeof kernels[0]; i++) {
+                if (!kernels[i].supported) {
+                        printf("%-32s unsupported\n", kernels[i].name);
+                        continue;
+                }
+                ok &= sb_check(kernels[i].name, kernels[i].blend);
+                sb_bench(kernels[i].name, kernels[i].blend);
+        }
+
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
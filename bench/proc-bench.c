@@ -0,0 +1,104 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../proc.h"
+
+#define ITERATIONS 1000000
+#define PROC_ITERATIONS 100000
+#define PROC_BUF_SIZE 256
+#define FIXTURE_SIZE 65536
+
+/*
+ * Microbenchmark for the load segment's /proc/stat parser
+ * usage: proc-bench [/proc/stat capture]
+ */
+
+// keeps the compiler from throwing the parsed values away
+volatile unsigned long long sink;
+
+double sb_elapsed_ns(const struct timespec *start, const struct timespec *end) {
+        return (end->tv_sec - start->tv_sec) * 1e9 + (end->tv_nsec - start->tv_nsec);
+}
+
+/*
+ * What the scanner avoids: tokenizing every number in the file
+ */
+void sb_tokenize_all(const char *stat) {
+        unsigned long long n = 0;
+        const char *c = stat;
+
+        while (*c != '\0') {
+                if (sb_is_numeric(*c))
+                        n += sb_scan_ull(&c);
+                else
+                        c++;
+        }
+        sink = n;
+}
+
+void sb_bench_fd(const char *name, int fd, int iterations) {
+        char buffer[PROC_BUF_SIZE];
+        unsigned long long busy, total;
+        struct timespec start, end;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < iterations; i++) {
+                sb_pread_start(fd, buffer, sizeof buffer);
+                sb_parse_stat(buffer, &busy, &total);
+                sink = busy + total;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-32s %8.1f ns\n", name, sb_elapsed_ns(&start, &end) / iterations);
+}
+
+int main(int argc, char **argv) {
+        const char *path = argc > 1 ? argv[1] : "bench/proc-stat-128cpu";
+        static char fixture[FIXTURE_SIZE];
+        unsigned long long busy, total;
+        struct timespec start, end;
+        ssize_t len;
+        int fd;
+
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+                perror(path);
+                return EXIT_FAILURE;
+        }
+        len = read(fd, fixture, sizeof fixture - 1);
+        if (len <= 0) {
+                fprintf(stderr, "%s: empty\n", path);
+                return EXIT_FAILURE;
+        }
+        fixture[len] = '\0';
+        printf("%s: %zd bytes\n", path, len);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ITERATIONS; i++) {
+                sb_parse_stat(fixture, &busy, &total);
+                sink = busy + total;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-32s %8.1f ns\n", "sb_parse_stat", sb_elapsed_ns(&start, &end) / ITERATIONS);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < ITERATIONS; i++)
+                sb_tokenize_all(fixture);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        printf("%-32s %8.1f ns\n", "tokenize whole file", sb_elapsed_ns(&start, &end) / ITERATIONS);
+
+        sb_bench_fd("pread + sb_parse_stat (fixture)", fd, ITERATIONS);
+        close(fd);
+
+        // the kernel renders all of /proc/stat on every read, whatever we parse
+        fd = open("/proc/stat", O_RDONLY);
+        if (fd != -1) {
+                sb_bench_fd("pread + sb_parse_stat (/proc)", fd, PROC_ITERATIONS);
+                close(fd);
+        }
+
+        return EXIT_SUCCESS;
+}
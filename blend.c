@@ -0,0 +1,110 @@
+#include <string.h>
+
+#include "blend.h"
+
+#ifdef SB_HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+/*
+ * Blends one row of glyph coverage in color over dst
+ * Every kernel computes (color * m + dst * (255 - m)) / 255 rounded the same
+ * way, so they all give exactly the same pixels
+ */
+void sb_blend_row_scalar(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+        for (int i = 0; i < n; i++) {
+                uint32_t m = mask[i], pixel = dst[i], out = 0;
+                if (m == 0)
+                        continue;
+                for (int shift = 0; shift < 32; shift += 8) {
+                        uint32_t t = ((color >> shift) & 0xFF) * m
+                                + ((pixel >> shift) & 0xFF) * (255 - m) + 128;
+                        out |= ((t + (t >> 8)) >> 8) << shift;
+                }
+                dst[i] = out;
+        }
+}
+
+#ifdef SB_HAVE_X86_SIMD
+/*
+ * Blends the 16 bit channels in dst and mask with src, see sb_blend_row_scalar
+ */
+__attribute__((target("sse2")))
+static inline __m128i sb_blend_16_sse2(__m128i dst, __m128i mask, __m128i src) {
+        __m128i inverse = _mm_sub_epi16(_mm_set1_epi16(255), mask),
+                t = _mm_add_epi16(
+                        _mm_add_epi16(_mm_mullo_epi16(src, mask), _mm_mullo_epi16(dst, inverse)),
+                        _mm_set1_epi16(128)
+                );
+        return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("sse2")))
+void sb_blend_row_sse2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+        const __m128i zero = _mm_setzero_si128(),
+                      src = _mm_unpacklo_epi8(_mm_set1_epi32(color), zero);
+        int i = 0;
+
+        for (; i + 4 <= n; i += 4) {
+                int32_t m4;
+                __m128i m, pixels;
+
+                memcpy(&m4, mask + i, sizeof m4);
+                if (m4 == 0)
+                        continue;
+                // replicate each coverage byte into all 4 channels of its pixel
+                m = _mm_cvtsi32_si128(m4);
+                m = _mm_unpacklo_epi8(m, m);
+                m = _mm_unpacklo_epi16(m, m);
+                pixels = _mm_loadu_si128((const __m128i *)(dst + i));
+                pixels = _mm_packus_epi16(
+                        sb_blend_16_sse2(_mm_unpacklo_epi8(pixels, zero), _mm_unpacklo_epi8(m, zero), src),
+                        sb_blend_16_sse2(_mm_unpackhi_epi8(pixels, zero), _mm_unpackhi_epi8(m, zero), src)
+                );
+                _mm_storeu_si128((__m128i *)(dst + i), pixels);
+        }
+        sb_blend_row_scalar(dst + i, mask + i, n - i, color);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i sb_blend_16_avx2(__m256i dst, __m256i mask, __m256i src) {
+        __m256i inverse = _mm256_sub_epi16(_mm256_set1_epi16(255), mask),
+                t = _mm256_add_epi16(
+                        _mm256_add_epi16(_mm256_mullo_epi16(src, mask), _mm256_mullo_epi16(dst, inverse)),
+                        _mm256_set1_epi16(128)
+                );
+        return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_srli_epi16(t, 8)), 8);
+}
+
+__attribute__((target("avx2")))
+void sb_blend_row_avx2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color) {
+        const __m256i zero = _mm256_setzero_si256(),
+                      src = _mm256_unpacklo_epi8(_mm256_set1_epi32(color), zero),
+                      // coverage bytes 0-3 go to the low lane, 4-7 to the high one
+                      replicate = _mm256_setr_epi8(
+                              0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3,
+                              4, 4, 4, 4, 5, 5, 5, 5, 6, 6, 6, 6, 7, 7, 7, 7
+                      );
+        int i = 0;
+
+        for (; i + 8 <= n; i += 8) {
+                __m128i m8 = _mm_loadl_epi64((const __m128i *)(mask + i));
+                __m256i m, pixels;
+
+                if (_mm_cvtsi128_si64(m8) == 0)
+                        continue;
+                // copy each coverage byte to every channel of its pixel
+                m = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(m8), replicate);
+                pixels = _mm256_loadu_si256((const __m256i *)(dst + i));
+                // unpack and pack both stay within 128 bit lanes, so order is kept
+                pixels = _mm256_packus_epi16(
+                        sb_blend_16_avx2(_mm256_unpacklo_epi8(pixels, zero), _mm256_unpacklo_epi8(m, zero), src),
+                        sb_blend_16_avx2(_mm256_unpackhi_epi8(pixels, zero), _mm256_unpackhi_epi8(m, zero), src)
+                );
+                _mm256_storeu_si256((__m256i *)(dst + i), pixels);
+        }
+        // the tail is legacy SSE, which stalls on dirty upper halves
+        _mm256_zeroupper();
+        sb_blend_row_sse2(dst + i, mask + i, n - i, color);
+}
+#endif
@@ -0,0 +1,21 @@
+#ifndef SB_BLEND_H
+#define SB_BLEND_H
+
+#include <stdint.h>
+
+/*
+ * Row blending kernels for the MIT-SHM backend;
+ * kept apart from main.c so they can be benchmarked without X
+ */
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define SB_HAVE_X86_SIMD
+#endif
+
+void sb_blend_row_scalar(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+#ifdef SB_HAVE_X86_SIMD
+void sb_blend_row_sse2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+void sb_blend_row_avx2(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+#endif
+
+#endif
@@ -1,5 +1,7 @@
 #include <poll.h>
 #include <signal.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -8,10 +10,20 @@
 #include <fcntl.h>
 
 #include <sys/inotify.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/timerfd.h>
 #include <sys/wait.h>
 
+#include <linux/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
 #include <xcb/xcb.h>
+#include <xcb/present.h>
+#include <xcb/shm.h>
 #include <xcb/xcb_aux.h>
 #include <xcb/xcb_renderutil.h>
 
@@ -22,6 +34,9 @@
 #include "fonts-for-xcb/utf8_utils/utf8.h"
 #include "fonts-for-xcb/xcbft/xcbft.h"
 
+#include "blend.h"
+#include "proc.h"
+
 #define SB_NUM_CHARS 3
 #define SCREEN_NUMBER 0
 #define ERROR NULL
@@ -32,9 +47,20 @@
 #define BATTERY_DIRECTORY "/sys/class/power_supply/BAT0"
 #define LIGHT_LENGTH 15
 #define LIGHT_DIRECTORY "/sys/class/backlight/intel_backlight"
+#define NETWORK_LENGTH 20
+#define NETLINK_BUF_SIZE 16384
+#define LOAD_LENGTH 25
+#define PROC_BUF_SIZE 256
+#define SEGMENT_LENGTH STDIN_LINE_LENGTH
+#define SB_TRACE_MAGIC "sbtrace2"
+#define PROBE_PENDING 32
+#define PROBE_BUFFERS 2
+#define CONFIG_PATH_LENGTH 1024
+#define CONFIG_LINE_LENGTH 256
+#define SB_GLYPH_MAX 128
 #define DPI 336
 #define FONT_STRING "Source Code Pro:dpi=336:size=7:antialias=true:style=bold"
-#define CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890[] %●"
+#define CHARS "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ1234567890[] %.●"
 #define BACKGROUND_COLOR 0xFF161821
 #define STRUTS_NUM_ARGS 12
 #define FONT_HEIGHT 32
@@ -49,7 +75,6 @@
 #define DEBUG_BOOL(B) printf("%s\n", (B) ? "true" : "false")
 #define sb_pen_to_char(p) ((p) + '0')
 #define sb_char_to_pen(c) ((c) - '0')
-#define sb_is_numeric(c)  (((c) ^ '0') < 10)
 
 enum {
         SB_POLL_STDIN = 0,
@@ -57,9 +82,36 @@ enum {
         SB_POLL_VOLUME,
         SB_POLL_BATTERY,
         SB_POLL_LIGHT,
+        SB_POLL_NETWORK,
+        SB_POLL_X,
+        SB_POLL_SIGNAL,
         SB_POLL_MAX
 };
 
+// the pieces of text on the bar, in the order they are drawn
+enum SB_SEGMENT {
+        SB_SEGMENT_STDIN = 0,
+        SB_SEGMENT_TIME,
+        SB_SEGMENT_NETWORK,
+        SB_SEGMENT_LOAD,
+        SB_SEGMENT_VOLUME,
+        SB_SEGMENT_BATTERY,
+        SB_SEGMENT_LIGHT,
+        SB_SEGMENT_RECORDING,
+        SB_SEGMENT_MAX
+};
+
+const char *SB_SEGMENT_NAME[SB_SEGMENT_MAX] = {
+        "stdin",
+        "clock",
+        "network",
+        "load",
+        "volume",
+        "battery",
+        "light",
+        "recording",
+};
+
 // these names correspond to my alacritty config
 enum SB_PEN {
         SB_FG = 0,
@@ -82,6 +134,16 @@ const xcb_render_color_t SB_PEN_COLOR[SB_PEN_MAX] = {
 };
 #undef SB_MAKE_COLOR
 
+// names of the pens in the config file
+const char *SB_PEN_NAME[SB_PEN_MAX] = {
+        "fg",
+        "black_b",
+        "green_n",
+        "cyan_b",
+        "red_n",
+        "yellow_n",
+};
+
 enum {
         NET_WM_WINDOW_TYPE = 0,
         NET_WM_WINDOW_TYPE_DOCK,
@@ -97,6 +159,55 @@ const struct { char *name; int len; } SB_ATOM_STRING[SB_ATOM_MAX] = {
 };
 #undef SB_MAKE_ATOM_STRING
 
+/*
+ * Everything that can be changed from the config file at runtime
+ * The macros above are the defaults, used for anything the file leaves out
+ */
+struct sb_config {
+        xcb_render_color_t pens[SB_PEN_MAX];
+        uint32_t background;
+        char font[CONFIG_LINE_LENGTH];
+        int dpi, font_height, line_padding, x_off, width;
+};
+
+// numeric config keys and the values they accept
+#define SB_CONFIG_INT(name, min, max) { #name, offsetof(struct sb_config, name), min, max }
+const struct { const char *name; size_t offset; long min, max; } SB_CONFIG_INTS[] = {
+        SB_CONFIG_INT(dpi, 1, 10000),
+        SB_CONFIG_INT(font_height, 1, 1000),
+        SB_CONFIG_INT(line_padding, 1, 1000),
+        SB_CONFIG_INT(x_off, 0, 1000),
+        // the window width is a CARD16
+        SB_CONFIG_INT(width, 1, 65535),
+};
+#undef SB_CONFIG_INT
+#define SB_CONFIG_INTS_MAX (sizeof SB_CONFIG_INTS / sizeof SB_CONFIG_INTS[0])
+
+// a glyph rasterized by FreeType, for client side rendering
+struct sb_glyph {
+        uint32_t codepoint;
+        int left, top, width, rows, advance;
+        uint8_t *coverage;
+};
+
+/*
+ * MIT-SHM backend state; image is shared with the server, front is a copy
+ * of what it last got so that only damaged rows have to be sent again
+ * fence is a round trip queued after the last ShmPutImage
+ */
+struct shm_backend {
+        xcb_shm_seg_t seg;
+        int shmid;
+        xcb_gcontext_t gc;
+        uint32_t *image, *front;
+        unsigned int width, height;
+        int full_damage, fence_pending;
+        xcb_get_input_focus_cookie_t fence;
+        struct sb_glyph glyphs[SB_GLYPH_MAX];
+        int num_glyphs;
+        void (*blend_row)(uint32_t *dst, const uint8_t *mask, int n, uint32_t color);
+};
+
 /*
  * Struct which owns all the critical stuff
  * Basically instead of having all of these as globals;
@@ -114,9 +225,23 @@ struct sam_bar {
         xcb_render_picture_t pens[SB_PEN_MAX];
         xcb_render_glyphset_t glyphset;
 
+        // what frames get drawn into: the window and picture above,
+        // or a buffer the latency probe is about to present
+        xcb_drawable_t target;
+        xcb_render_picture_t target_picture;
+
         struct xcbft_face_holder face_holder;
 
         unsigned int width, height;
+
+        struct sb_config config;
+        char config_path[CONFIG_PATH_LENGTH];
+
+        // NULL unless rendering client side through MIT-SHM
+        struct shm_backend *shm;
+
+        // NULL unless probing latency
+        struct latency_probe *probe;
 };
 
 enum {
@@ -145,6 +270,666 @@ struct exec_info {
     pid_t pid;
 };
 
+/*
+ * Everything that gets drawn
+ */
+struct bar_state {
+        char segments[SB_SEGMENT_MAX][SEGMENT_LENGTH];
+        int hide;
+};
+
+/*
+ * Trace records, in native byte order: kind:u8 len:u16 bytes
+ * A trace is SB_TRACE_MAGIC, the records of the initial sensor reads, then
+ * for every wakeup an SB_INPUT_EVENT followed by the records of whatever
+ * its handler read, in the order it read them
+ */
+enum SB_INPUT {
+        SB_INPUT_EVENT = 0, // delta_us:u32 source:u8, the poll index that woke us
+        SB_INPUT_STDIN,     // a line from stdin, empty at EOF
+        SB_INPUT_TIMER,     // timerfd expirations:u64
+        SB_INPUT_CLOCK,     // time_t for the clock segment
+        SB_INPUT_FILE,      // the start of a sysfs file
+        SB_INPUT_EXEC,      // the output of a child process
+        SB_INPUT_PROC,      // the start of a /proc file, empty if it failed
+        SB_INPUT_NETLINK,   // running:i64 rx:u64 tx:u64 from sb_netlink_query
+        SB_INPUT_LINK,      // whether link notifications asked for a query:u8
+};
+
+/*
+ * Where the handlers' raw inputs come from
+ * Live, every read hits the real fd/file/process and, if record is set,
+ * also gets appended to the trace; if replay is set the reads are served
+ * from the trace instead, so the same parsers run on the same bytes
+ */
+struct bar_io {
+        FILE *record, *replay;
+};
+
+struct latency_samples {
+        unsigned long long *ns;
+        size_t count, max;
+};
+
+/*
+ * Optional event-to-vblank probe
+ * Frames are drawn into one of buffers and shown with PresentPixmap, whose
+ * CompleteNotify says when that frame reached the screen; a buffer is only
+ * drawn into again once the server sends IdleNotify for it
+ * pending remembers when the events behind each frame arrived
+ * If the buffers can't be created, frames go straight to the window and
+ * are followed by a NotifyMSC for the next vblank instead; that isn't tied
+ * to the frame, so under a compositor it may only show up a repaint later
+ */
+struct latency_probe {
+        uint8_t present_opcode;
+        xcb_present_event_t eid;
+        uint32_t serial;
+        int use_pixmaps, presented;
+        xcb_render_pictformat_t format;
+        // the buffers follow the window's width
+        unsigned int width;
+        int current;
+        struct {
+                xcb_pixmap_t pixmap;
+                xcb_render_picture_t picture;
+                int idle;
+        } buffers[PROBE_BUFFERS];
+        struct {
+                uint32_t serial;
+                unsigned int sources;
+                unsigned long long event_ns;
+        } pending[PROBE_PENDING];
+        struct latency_samples samples[SB_SEGMENT_MAX];
+};
+
+/*
+ * rtnetlink state for the network segment
+ * query_fd is only used for RTM_GETLINK dumps; event_fd is subscribed to
+ * RTMGRP_LINK so link up/down notifications don't get mixed into the dumps
+ */
+struct network_info {
+        int query_fd, event_fd;
+        unsigned int seq;
+        unsigned long long rx_bytes, tx_bytes;
+        unsigned long rx_rate, tx_rate;
+        int up;
+};
+
+/*
+ * /proc/stat and /proc/meminfo are kept open and re-read with pread,
+ * busy and total are the cpu jiffies from the last sample
+ */
+struct load_info {
+        int stat_fd, meminfo_fd;
+        unsigned long long busy, total;
+};
+
+/*
+ * Everything the loop's handlers work on, so the live loop and trace
+ * replay can run the same ones
+ * redraw and triggers are what the last handler decided: whether to draw,
+ * and the SB_SEGMENT bitmask of what caused it
+ */
+struct bar_loop {
+        struct sam_bar *sam_bar;
+        struct bar_io io;
+        struct bar_state state;
+        struct pollfd pollfds[SB_POLL_MAX];
+        struct exec_info pactl_info;
+        struct network_info network_info;
+        struct load_info load_info;
+        unsigned long elapsed;
+        unsigned long long last_event_ns;
+        int just_pamixer, redraw;
+        unsigned int triggers;
+};
+
+/*
+ * Rasterizes every character in CHARS into the glyph cache
+ */
+void sb_shm_load_glyphs(struct sam_bar *sam_bar) {
+        struct shm_backend *shm = sam_bar->shm;
+        struct utf_holder chars = char_to_uint32(CHARS);
+
+        for (int i = 0; i < shm->num_glyphs; i++)
+                free(shm->glyphs[i].coverage);
+        shm->num_glyphs = 0;
+
+        for (unsigned int i = 0; i < chars.length && shm->num_glyphs < SB_GLYPH_MAX; i++) {
+                for (int f = 0; f < sam_bar->face_holder.length; f++) {
+                        FT_Face face = sam_bar->face_holder.faces[f];
+                        FT_UInt index = FT_Get_Char_Index(face, chars.str[i]);
+                        FT_Bitmap *bitmap;
+                        struct sb_glyph *glyph;
+
+                        // fall back on the next face, like the glyphset does
+                        if (index == 0 || FT_Load_Glyph(face, index, FT_LOAD_RENDER) != 0)
+                                continue;
+                        bitmap = &face->glyph->bitmap;
+                        if (bitmap->pixel_mode != FT_PIXEL_MODE_GRAY && bitmap->rows != 0)
+                                continue;
+
+                        glyph = &shm->glyphs[shm->num_glyphs++];
+                        glyph->codepoint = chars.str[i];
+                        glyph->left = face->glyph->bitmap_left;
+                        glyph->top = face->glyph->bitmap_top;
+                        glyph->width = bitmap->width;
+                        glyph->rows = bitmap->rows;
+                        glyph->advance = face->glyph->advance.x >> 6;
+                        glyph->coverage = malloc(glyph->width * glyph->rows + 1);
+                        for (int row = 0; row < glyph->rows; row++) {
+                                memcpy(
+                                        glyph->coverage + row * glyph->width,
+                                        bitmap->buffer + row * bitmap->pitch,
+                                        glyph->width
+                                );
+                        }
+                        break;
+                }
+        }
+
+        utf_holder_destroy(chars);
+}
+
+/*
+ * Sets up the MIT-SHM backend: a shared memory image of the whole bar,
+ * a private copy of what was last pushed (to find damaged rows)
+ * and the glyph cache
+ * Returns false and leaves sam_bar->shm NULL if the server can't do it
+ */
+int sb_shm_init(struct sam_bar *sam_bar) {
+        const xcb_query_extension_reply_t *extension;
+        struct shm_backend *shm;
+        size_t size = sam_bar->width * sam_bar->height * sizeof(uint32_t);
+        xcb_generic_error_t *error;
+
+        extension = xcb_get_extension_data(sam_bar->connection, &xcb_shm_id);
+        if (extension == NULL || !extension->present)
+                return false;
+
+        shm = calloc(1, sizeof *shm);
+        shm->width = sam_bar->width;
+        shm->height = sam_bar->height;
+        shm->shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600);
+        if (shm->shmid == -1) {
+                free(shm);
+                return false;
+        }
+        shm->image = shmat(shm->shmid, NULL, 0);
+        if (shm->image == (void *)-1) {
+                shmctl(shm->shmid, IPC_RMID, NULL);
+                free(shm);
+                return false;
+        }
+        shm->seg = xcb_generate_id(sam_bar->connection);
+        error = xcb_request_check(
+                sam_bar->connection,
+                xcb_shm_attach_checked(sam_bar->connection, shm->seg, shm->shmid, true)
+        );
+        // the server has it attached now (or never will), so it can go
+        // away as soon as we both detach
+        shmctl(shm->shmid, IPC_RMID, NULL);
+        if (error != NULL) {
+                // e.g. a remote display
+                free(error);
+                shmdt(shm->image);
+                free(shm);
+                return false;
+        }
+
+        shm->front = malloc(size);
+        shm->full_damage = true;
+        shm->gc = xcb_generate_id(sam_bar->connection);
+        xcb_create_gc(sam_bar->connection, shm->gc, sam_bar->window, 0, NULL);
+
+        shm->blend_row = sb_blend_row_scalar;
+#ifdef SB_HAVE_X86_SIMD
+        if (__builtin_cpu_supports("avx2"))
+                shm->blend_row = sb_blend_row_avx2;
+        else if (__builtin_cpu_supports("sse2"))
+                shm->blend_row = sb_blend_row_sse2;
+#endif
+
+        sam_bar->shm = shm;
+        sb_shm_load_glyphs(sam_bar);
+        return true;
+}
+
+void sb_shm_destroy(struct sam_bar *sam_bar) {
+        struct shm_backend *shm = sam_bar->shm;
+
+        if (shm->fence_pending)
+                free(xcb_get_input_focus_reply(sam_bar->connection, shm->fence, ERROR));
+        xcb_shm_detach(sam_bar->connection, shm->seg);
+        xcb_free_gc(sam_bar->connection, shm->gc);
+        shmdt(shm->image);
+        free(shm->front);
+        for (int i = 0; i < shm->num_glyphs; i++)
+                free(shm->glyphs[i].coverage);
+        free(shm);
+        sam_bar->shm = NULL;
+}
+
+/*
+ * Starts a new frame by filling the image with the background
+ */
+void sb_shm_clear(struct sam_bar *sam_bar) {
+        struct shm_backend *shm = sam_bar->shm;
+        size_t pixels = shm->width * shm->height;
+
+        // the server may still be reading the last frame out of the image
+        if (shm->fence_pending) {
+                free(xcb_get_input_focus_reply(sam_bar->connection, shm->fence, ERROR));
+                shm->fence_pending = false;
+        }
+        for (size_t i = 0; i < pixels; i++)
+                shm->image[i] = sam_bar->config.background;
+}
+
+const struct sb_glyph *sb_shm_find_glyph(const struct shm_backend *shm,
+                uint32_t codepoint) {
+        for (int i = 0; i < shm->num_glyphs; i++) {
+                if (shm->glyphs[i].codepoint == codepoint)
+                        return &shm->glyphs[i];
+        }
+        return NULL;
+}
+
+/*
+ * Draws one line of glyphs with its baseline at y
+ */
+void sb_shm_draw_glyphs(struct sam_bar *sam_bar, int y, enum SB_PEN pen,
+                const FcChar32 *text, int length) {
+        struct shm_backend *shm = sam_bar->shm;
+        const xcb_render_color_t *pen_color = &sam_bar->config.pens[pen];
+        uint32_t color = (uint32_t)(pen_color->alpha >> 8) << 24
+                | (uint32_t)(pen_color->red >> 8) << 16
+                | (uint32_t)(pen_color->green >> 8) << 8
+                | (uint32_t)(pen_color->blue >> 8);
+        int x = sam_bar->config.x_off;
+
+        for (int i = 0; i < length; i++) {
+                const struct sb_glyph *glyph = sb_shm_find_glyph(shm, text[i]);
+                int left, right;
+
+                if (glyph == NULL)
+                        continue;
+
+                // clip horizontally once, then blend row by row
+                left = x + glyph->left < 0 ? -(x + glyph->left) : 0;
+                right = x + glyph->left + glyph->width > (int)shm->width
+                        ? (int)shm->width - x - glyph->left
+                        : glyph->width;
+                for (int row = 0; row < glyph->rows && left < right; row++) {
+                        int image_y = y - glyph->top + row;
+                        if (image_y < 0 || image_y >= (int)shm->height)
+                                continue;
+                        shm->blend_row(
+                                shm->image + image_y * shm->width + x + glyph->left + left,
+                                glyph->coverage + row * glyph->width + left,
+                                right - left,
+                                color
+                        );
+                }
+                x += glyph->advance;
+        }
+}
+
+void sb_shm_put_rows(struct sam_bar *sam_bar, unsigned int start, unsigned int end) {
+        struct shm_backend *shm = sam_bar->shm;
+
+        xcb_shm_put_image(
+                sam_bar->connection,
+                sam_bar->target,
+                shm->gc,
+                shm->width, shm->height,
+                0, start, // src x, y
+                shm->width, end - start,
+                0, start, // dst x, y
+                32,
+                XCB_IMAGE_FORMAT_Z_PIXMAP,
+                false, // no completion event
+                shm->seg,
+                0
+        );
+        memcpy(
+                shm->front + start * shm->width,
+                shm->image + start * shm->width,
+                (end - start) * shm->width * sizeof(uint32_t)
+        );
+}
+
+/*
+ * Sends only the runs of rows which differ from the last frame pushed
+ */
+void sb_shm_push(struct sam_bar *sam_bar) {
+        struct shm_backend *shm = sam_bar->shm;
+        size_t row_size = shm->width * sizeof(uint32_t);
+        unsigned int start = 0;
+        int in_run = false, pushed = false;
+
+        for (unsigned int y = 0; y < shm->height; y++) {
+                int damaged = shm->full_damage || memcmp(
+                        shm->image + y * shm->width,
+                        shm->front + y * shm->width,
+                        row_size
+                ) != 0;
+
+                if (damaged && !in_run) {
+                        start = y;
+                        in_run = true;
+                } else if (!damaged && in_run) {
+                        sb_shm_put_rows(sam_bar, start, y);
+                        in_run = false;
+                        pushed = true;
+                }
+        }
+        if (in_run) {
+                sb_shm_put_rows(sam_bar, start, shm->height);
+                pushed = true;
+        }
+        shm->full_damage = false;
+
+        if (pushed) {
+                // a reply to this means the server is done with the image
+                shm->fence = xcb_get_input_focus(sam_bar->connection);
+                shm->fence_pending = true;
+        }
+}
+
+/*
+ * Parses a colour written as RRGGBB, optionally with a leading #
+ */
+/*
+ * Parses RRGGBB or AARRGGBB hex, with an optional leading #
+ * Returns the number of digits, or 0 if value is neither
+ */
+int sb_parse_hex(const char *value, uint32_t *argb) {
+        const char *c;
+        uint32_t n = 0;
+
+        if (value[0] == '#')
+                value++;
+        for (c = value; *c != '\0'; c++) {
+                int digit;
+
+                if (sb_is_numeric(*c))
+                        digit = *c - '0';
+                else if (*c >= 'a' && *c <= 'f')
+                        digit = *c - 'a' + 10;
+                else if (*c >= 'A' && *c <= 'F')
+                        digit = *c - 'A' + 10;
+                else
+                        return 0;
+                if (c - value == 8)
+                        return 0;
+                n = n << 4 | digit;
+        }
+        if (c - value != 6 && c - value != 8)
+                return 0;
+        *argb = n;
+        return c - value;
+}
+
+/*
+ * Parses an RRGGBB pen colour
+ * Returns false if value isn't one
+ */
+int sb_parse_color(const char *value, xcb_render_color_t *color) {
+        uint32_t rgb;
+
+        if (sb_parse_hex(value, &rgb) != 6)
+                return false;
+        // 0xAB -> 0xABAB, same as SB_MAKE_COLOR
+        color->red = ((rgb >> 16) & 0xFF) * 0x101;
+        color->green = ((rgb >> 8) & 0xFF) * 0x101;
+        color->blue = (rgb & 0xFF) * 0x101;
+        color->alpha = 0xFFFF;
+        return true;
+}
+
+void sb_config_defaults(struct sb_config *config) {
+        memcpy(config->pens, SB_PEN_COLOR, sizeof config->pens);
+        config->background = BACKGROUND_COLOR;
+        strcpy(config->font, FONT_STRING);
+        config->dpi = DPI;
+        config->font_height = FONT_HEIGHT;
+        config->line_padding = LINE_PADDING;
+        config->x_off = X_OFF;
+        config->width = WIDTH;
+}
+
+/*
+ * Parses value as a whole number between min and max
+ * Returns false, leaving *n alone, if it isn't one
+ */
+int sb_parse_long(const char *value, long min, long max, long *n) {
+        char *end;
+        long parsed = strtol(value, &end, 10);
+
+        if (end == value || *end != '\0' || parsed < min || parsed > max)
+                return false;
+        *n = parsed;
+        return true;
+}
+
+/*
+ * Reads "key = value" lines from path on top of the defaults
+ * A missing file just means the defaults; a bad number or colour keeps
+ * its value from previous, or the default if previous is NULL
+ */
+void sb_config_load(struct sb_config *config, const char *path,
+                const struct sb_config *previous) {
+        char line[CONFIG_LINE_LENGTH];
+        FILE *file;
+        struct sb_config defaults;
+
+        sb_config_defaults(&defaults);
+        if (previous == NULL)
+                previous = &defaults;
+        *config = defaults;
+        if (path[0] == '\0' || (file = fopen(path, "r")) == NULL)
+                return;
+
+        while (fgets(line, sizeof line, file) != NULL) {
+                char *key = line, *value, *end;
+                int found = false;
+
+                while (*key == ' ' || *key == '\t')
+                        key++;
+                if (*key == '#' || *key == '\n' || *key == '\0')
+                        continue;
+                if ((value = strchr(key, '=')) == NULL) {
+                        fprintf(stderr, "%s: ignoring %s", path, line);
+                        continue;
+                }
+
+                // trim both sides of the key and the value
+                for (end = value; end > key && (end[-1] == ' ' || end[-1] == '\t'); end--);
+                *end = '\0';
+                for (value++; *value == ' ' || *value == '\t'; value++);
+                for (end = value + strlen(value);
+                                end > value && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\n');
+                                end--);
+                *end = '\0';
+
+                for (int i = 0; i < SB_PEN_MAX; i++) {
+                        if (strcmp(key, SB_PEN_NAME[i]) != 0)
+                                continue;
+                        if (!sb_parse_color(value, &config->pens[i])) {
+                                fprintf(stderr, "%s: ignoring %s = %s\n", path, key, value);
+                                config->pens[i] = previous->pens[i];
+                        }
+                        found = true;
+                }
+                for (size_t i = 0; i < SB_CONFIG_INTS_MAX; i++) {
+                        int *field;
+                        long n;
+
+                        if (strcmp(key, SB_CONFIG_INTS[i].name) != 0)
+                                continue;
+                        field = (int *)((char *)config + SB_CONFIG_INTS[i].offset);
+                        if (sb_parse_long(value, SB_CONFIG_INTS[i].min, SB_CONFIG_INTS[i].max, &n)) {
+                                *field = n;
+                        } else {
+                                fprintf(stderr, "%s: ignoring %s = %s\n", path, key, value);
+                                *field = *(const int *)((const char *)previous + SB_CONFIG_INTS[i].offset);
+                        }
+                        found = true;
+                }
+                if (found) {
+                        continue;
+                } else if (strcmp(key, "background") == 0) {
+                        // ARGB, since the window has a 32 bit visual;
+                        // plain RGB is taken to be opaque
+                        uint32_t argb;
+                        switch (sb_parse_hex(value, &argb)) {
+                        case 8:
+                                config->background = argb;
+                                break;
+                        case 6:
+                                config->background = 0xFF000000 | argb;
+                                break;
+                        default:
+                                fprintf(stderr, "%s: ignoring %s = %s\n", path, key, value);
+                                config->background = previous->background;
+                                break;
+                        }
+                } else if (strcmp(key, "font") == 0) {
+                        strcpy(config->font, value);
+                } else {
+                        fprintf(stderr, "%s: unknown key %s\n", path, key);
+                }
+        }
+
+        fclose(file);
+}
+
+/*
+ * Points config_path at $XDG_CONFIG_HOME/sam-bar/config,
+ * falling back on ~/.config/sam-bar/config
+ */
+void sb_config_default_path(char *config_path) {
+        const char *dir = getenv("XDG_CONFIG_HOME"), *home = getenv("HOME");
+
+        if (dir != NULL && dir[0] != '\0')
+                snprintf(config_path, CONFIG_PATH_LENGTH, "%s/sam-bar/config", dir);
+        else if (home != NULL)
+                snprintf(config_path, CONFIG_PATH_LENGTH, "%s/.config/sam-bar/config", home);
+        else
+                config_path[0] = '\0';
+}
+
+void sb_create_pens(struct sam_bar *sam_bar) {
+        for (int i = 0; i < SB_PEN_MAX; i++) {
+                sam_bar->pens[i] = xcbft_create_pen(
+                        sam_bar->connection,
+                        sam_bar->config.pens[i]
+                );
+        }
+}
+
+/*
+ * Loads the faces and glyphset for the configured font
+ * Assumptions:
+ * - xcbft_init has been called
+ */
+void sb_load_font(struct sam_bar *sam_bar) {
+        FcStrSet *fontsearch;
+        struct xcbft_patterns_holder font_patterns;
+        struct utf_holder chars;
+
+        fontsearch = xcbft_extract_fontsearch_list(sam_bar->config.font);
+        font_patterns = xcbft_query_fontsearch_all(fontsearch);
+        FcStrSetDestroy(fontsearch);
+        sam_bar->face_holder = xcbft_load_faces(font_patterns, sam_bar->config.dpi);
+        xcbft_patterns_holder_destroy(font_patterns);
+        chars = char_to_uint32(CHARS);
+        sam_bar->glyphset = xcbft_load_glyphset(
+                        sam_bar->connection,
+                        sam_bar->face_holder,
+                        chars,
+                        sam_bar->config.dpi
+        ).glyphset;
+        utf_holder_destroy(chars);
+}
+
+/*
+ * Setup struts so windows don't overlap the bar
+ */
+void sb_set_struts(struct sam_bar *sam_bar) {
+        int struts[STRUTS_NUM_ARGS] = {0};
+        struts[LEFT] = sam_bar->width;
+        struts[LEFT_START_Y] = struts[RIGHT_START_Y] = 0;
+        struts[LEFT_END_Y] = struts[RIGHT_END_Y] = sam_bar->height;
+        struts[TOP_START_X] = struts[BOTTOM_START_X] = 0;
+        struts[TOP_END_X] = struts[BOTTOM_END_X] = sam_bar->width;
+        xcb_change_property(
+                sam_bar->connection,
+                XCB_PROP_MODE_REPLACE,
+                sam_bar->window,
+                sam_bar->atoms[NET_WM_STRUT_PARTIAL],
+                XCB_ATOM_CARDINAL,
+                32, // MAGIC NUMBER ?
+                STRUTS_NUM_ARGS, struts
+        );
+}
+
+/*
+ * Re-reads the config file and rebuilds only what actually changed;
+ * the window, helper processes and sensor state are left alone
+ */
+void sb_config_reload(struct sam_bar *sam_bar) {
+        struct sb_config old = sam_bar->config;
+        struct sb_config *config = &sam_bar->config;
+
+        sb_config_load(config, sam_bar->config_path, &old);
+
+        for (int i = 0; i < SB_PEN_MAX; i++) {
+                if (memcmp(&old.pens[i], &config->pens[i], sizeof old.pens[i]) == 0)
+                        continue;
+                xcb_render_free_picture(sam_bar->connection, sam_bar->pens[i]);
+                sam_bar->pens[i] = xcbft_create_pen(sam_bar->connection, config->pens[i]);
+        }
+
+        if (old.background != config->background) {
+                uint32_t value = config->background;
+                xcb_change_window_attributes(
+                        sam_bar->connection,
+                        sam_bar->window,
+                        XCB_CW_BACK_PIXEL,
+                        &value
+                );
+        }
+
+        if (strcmp(old.font, config->font) != 0 || old.dpi != config->dpi) {
+                xcb_render_free_glyph_set(sam_bar->connection, sam_bar->glyphset);
+                xcbft_face_holder_destroy(sam_bar->face_holder);
+                sb_load_font(sam_bar);
+                if (sam_bar->shm != NULL)
+                        sb_shm_load_glyphs(sam_bar);
+        }
+
+        if (old.width != config->width) {
+                uint32_t value = config->width;
+                sam_bar->width = config->width;
+                xcb_configure_window(
+                        sam_bar->connection,
+                        sam_bar->window,
+                        XCB_CONFIG_WINDOW_WIDTH,
+                        &value
+                );
+                sb_set_struts(sam_bar);
+                if (sam_bar->shm != NULL) {
+                        // the image is sized to the window
+                        sb_shm_destroy(sam_bar);
+                        if (!sb_shm_init(sam_bar))
+                                fprintf(stderr, "MIT-SHM failed, falling back on XRender\n");
+                }
+        }
+}
+
 void sb_test_cookie(const struct sam_bar *sam_bar,
                 xcb_void_cookie_t cookie, const char *message) {
         if (xcb_request_check(sam_bar->connection, cookie) != NULL) {
@@ -158,14 +943,14 @@ void sb_test_cookie(const struct sam_bar *sam_bar,
  * Assumptions:
  * - message matches ((#[0-9])?ccc)*, where c is one of the characters in CHARS
  */
-void sb_draw_text(const struct sam_bar *sam_bar, int y, const char *message) {
+void sb_draw_text(struct sam_bar *sam_bar, int y, const char *message) {
         enum SB_PEN pen;
         FcChar32 text_32[SB_NUM_CHARS];
         int message_len, line_height;
         xcb_render_util_composite_text_stream_t *text_stream;
 
         message_len = strlen(message);
-        line_height = FONT_HEIGHT + LINE_PADDING;
+        line_height = sam_bar->config.font_height + sam_bar->config.line_padding;
 
         for (; message[0] != '\0' && message[0] != '\n'; y += line_height) {
                 if (message[0] == '#') {
@@ -187,6 +972,11 @@ void sb_draw_text(const struct sam_bar *sam_bar, int y, const char *message) {
                         message += shift;
                 }
 
+                if (sam_bar->shm != NULL) {
+                        sb_shm_draw_glyphs(sam_bar, y, pen, text_32, SB_NUM_CHARS);
+                        continue;
+                }
+
                 text_stream = xcb_render_util_composite_text_stream(
                         sam_bar->glyphset,
                         SB_NUM_CHARS,
@@ -194,7 +984,7 @@ void sb_draw_text(const struct sam_bar *sam_bar, int y, const char *message) {
                 );
                 xcb_render_util_glyphs_32(
                         text_stream,
-                        X_OFF, y,
+                        sam_bar->config.x_off, y,
                         SB_NUM_CHARS,
                         text_32
                 );
@@ -202,7 +992,7 @@ void sb_draw_text(const struct sam_bar *sam_bar, int y, const char *message) {
                         sam_bar->connection,
                         XCB_RENDER_PICT_OP_OVER,
                         sam_bar->pens[pen],
-                        sam_bar->picture,
+                        sam_bar->target_picture,
                         0,
                         0, 0, // x, y
                         text_stream
@@ -228,7 +1018,10 @@ void sb_exec(struct exec_info *info, char **args) {
                 printf("fork failed\n");
                 exit(EXIT_FAILURE);
         } else if (info->pid == 0) {
-                // we are child
+                // we are child, which shouldn't inherit our blocked signals
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigprocmask(SIG_SETMASK, &mask, NULL);
                 dup2(info->pipe[WRITE_FD], STDOUT_FILENO);
                 close(info->pipe[WRITE_FD]);
                 close(info->pipe[READ_FD]);
@@ -269,14 +1062,200 @@ void sb_read(struct exec_info *info, char *buffer, size_t num_bytes) {
         close(info->pipe[READ_FD]);
 }
 
-void sb_loop_read_recording(char *recording_string) {
+/*
+ * Appends a record to the trace, if recording
+ */
+void sb_io_put(struct bar_io *io, int kind, const void *data, size_t len) {
+        uint16_t record_len = len;
+
+        if (io->record == NULL)
+                return;
+        fputc(kind, io->record);
+        fwrite(&record_len, sizeof record_len, 1, io->record);
+        fwrite(data, 1, len, io->record);
+}
+
+/*
+ * Reads the next record of the replayed trace into data
+ * Returns its length
+ * Assumptions:
+ * - the trace was recorded by a build making the same reads, else we exit
+ */
+size_t sb_io_get(struct bar_io *io, int kind, void *data, size_t size) {
+        uint16_t len;
+
+        if (fgetc(io->replay) != kind
+                        || fread(&len, sizeof len, 1, io->replay) != 1
+                        || len > size
+                        || fread(data, 1, len, io->replay) != len) {
+                fprintf(stderr, "trace is truncated or from another build\n");
+                exit(EXIT_FAILURE);
+        }
+        return len;
+}
+
+/*
+ * Starts the records of a wakeup; now_ns is when poll woke up for it,
+ * so handler time doesn't skew replay
+ */
+void sb_io_event(struct bar_io *io, unsigned long long *last_ns,
+                unsigned long long now_ns, int source) {
+        uint8_t event[sizeof(uint32_t) + 1];
+        uint32_t delta_us = (now_ns - *last_ns) / 1000;
+
+        *last_ns = now_ns;
+        memcpy(event, &delta_us, sizeof delta_us);
+        event[sizeof delta_us] = source;
+        sb_io_put(io, SB_INPUT_EVENT, event, sizeof event);
+}
+
+/*
+ * Reads the next wakeup of the replayed trace
+ * Returns false at the end of the trace
+ */
+int sb_io_next_event(struct bar_io *io, uint32_t *delta_us, int *source) {
+        uint8_t event[sizeof(uint32_t) + 1];
+        int c = fgetc(io->replay);
+
+        if (c == EOF)
+                return false;
+        ungetc(c, io->replay);
+        sb_io_get(io, SB_INPUT_EVENT, event, sizeof event);
+        memcpy(delta_us, event, sizeof *delta_us);
+        *source = event[sizeof *delta_us];
+        return true;
+}
+
+/*
+ * Throws away whatever fd has to read; the trace only needs what the
+ * handlers look at, so there's nothing to do when replaying
+ */
+void sb_io_drain(struct bar_io *io, int fd) {
+        char buffer[1024];
+
+        if (io->replay != NULL)
+                return;
+        while (read(fd, buffer, sizeof buffer) > 0);
+}
+
+/*
+ * Reads a line from stdin, null terminated
+ * Returns false at EOF
+ */
+int sb_io_stdin(struct bar_io *io, char *line, size_t size) {
+        size_t len;
+
+        if (io->replay != NULL) {
+                len = sb_io_get(io, SB_INPUT_STDIN, line, size - 1);
+        } else {
+                len = fgets(line, size, stdin) != NULL ? strlen(line) : 0;
+                sb_io_put(io, SB_INPUT_STDIN, line, len);
+        }
+        line[len] = '\0';
+        return len > 0;
+}
+
+uint64_t sb_io_timer(struct bar_io *io, int fd) {
+        uint64_t num = 0;
+
+        if (io->replay != NULL) {
+                sb_io_get(io, SB_INPUT_TIMER, &num, sizeof num);
+        } else {
+                read(fd, &num, sizeof num);
+                sb_io_put(io, SB_INPUT_TIMER, &num, sizeof num);
+        }
+        return num;
+}
+
+time_t sb_io_time(struct bar_io *io) {
+        time_t rawtime = 0;
+
+        if (io->replay != NULL) {
+                sb_io_get(io, SB_INPUT_CLOCK, &rawtime, sizeof rawtime);
+        } else {
+                time(&rawtime);
+                sb_io_put(io, SB_INPUT_CLOCK, &rawtime, sizeof rawtime);
+        }
+        return rawtime;
+}
+
+/*
+ * Reads up to size - 1 bytes from the start of a (sysfs) file, null
+ * terminated; empty if it can't be read
+ */
+void sb_io_file(struct bar_io *io, const char *path, char *buffer, size_t size) {
+        ssize_t len = 0;
+
+        if (io->replay != NULL) {
+                len = sb_io_get(io, SB_INPUT_FILE, buffer, size - 1);
+        } else {
+                int fd = open(path, O_RDONLY | O_CLOEXEC);
+                if (fd != -1) {
+                        len = read(fd, buffer, size - 1);
+                        close(fd);
+                }
+                if (len < 0)
+                        len = 0;
+                sb_io_put(io, SB_INPUT_FILE, buffer, len);
+        }
+        buffer[len] = '\0';
+}
+
+/*
+ * Starts args, unless replaying; its output is collected by sb_io_exec_read
+ * so several processes can run at once
+ * Assumptions:
+ * - the last element of args = NULL
+ */
+void sb_io_exec(struct bar_io *io, struct exec_info *info, char **args) {
+        if (io->replay == NULL)
+                sb_exec(info, args);
+}
+
+/*
+ * Waits for a process started by sb_io_exec and reads up to size - 1 bytes
+ * of its output into buffer, null terminated
+ */
+void sb_io_exec_read(struct bar_io *io, struct exec_info *info,
+                char *buffer, size_t size) {
+        size_t len;
+
+        if (io->replay != NULL) {
+                len = sb_io_get(io, SB_INPUT_EXEC, buffer, size - 1);
+                buffer[len] = '\0';
+                return;
+        }
+        sb_wait(info);
+        sb_read(info, buffer, size - 1);
+        sb_io_put(io, SB_INPUT_EXEC, buffer, strlen(buffer));
+}
+
+/*
+ * sb_pread_start, through the trace
+ */
+int sb_io_pread(struct bar_io *io, int fd, char *buffer, size_t size) {
+        size_t len;
+
+        if (io->replay != NULL) {
+                len = sb_io_get(io, SB_INPUT_PROC, buffer, size - 1);
+                buffer[len] = '\0';
+                return len > 0;
+        }
+        if (!sb_pread_start(fd, buffer, size)) {
+                sb_io_put(io, SB_INPUT_PROC, buffer, 0);
+                return false;
+        }
+        sb_io_put(io, SB_INPUT_PROC, buffer, strlen(buffer));
+        return true;
+}
+
+void sb_loop_read_recording(struct bar_io *io, char *recording_string) {
         char *pgrep[] = {"/usr/bin/pgrep", "-c", "ffmpeg-dummy", NULL},
              buffer[10] = {'0'};
         struct exec_info pgrep_info;
 
-        sb_exec(&pgrep_info, pgrep);
-        sb_wait(&pgrep_info);
-        sb_read(&pgrep_info, buffer, sizeof buffer);
+        sb_io_exec(io, &pgrep_info, pgrep);
+        sb_io_exec_read(io, &pgrep_info, buffer, sizeof buffer);
 
         if (buffer[0] == '0') {
                 recording_string[0] = '\0';
@@ -285,21 +1264,19 @@ void sb_loop_read_recording(char *recording_string) {
         }
 }
 
-void sb_loop_read_volume(char *volume_string) {
+void sb_loop_read_volume(struct bar_io *io, char *volume_string) {
         char *pamixer[] = {"/usr/bin/pamixer", "--get-volume-human", NULL},
              *bluetooth[] = {"/usr/bin/bluetoothctl", "info", MAC_ADDRESS, NULL},
              buffer[1024], volume_buffer[10];
         struct exec_info pamixer_info, bluetooth_info;
         int connected = false;
 
-        sb_exec(&pamixer_info, pamixer);
-        sb_exec(&bluetooth_info, bluetooth);
-        sb_wait(&pamixer_info);
-        sb_wait(&bluetooth_info);
+        sb_io_exec(io, &pamixer_info, pamixer);
+        sb_io_exec(io, &bluetooth_info, bluetooth);
 
         // assumption: $(bluetoothctl info | wc -c) < 1024
-        sb_read(&pamixer_info, volume_buffer, sizeof volume_buffer);
-        sb_read(&bluetooth_info, buffer, sizeof buffer);
+        sb_io_exec_read(io, &pamixer_info, volume_buffer, sizeof volume_buffer);
+        sb_io_exec_read(io, &bluetooth_info, buffer, sizeof buffer);
         connected = strstr(buffer, "Connected: yes") != NULL;
 
         // decide color
@@ -325,15 +1302,11 @@ void sb_loop_read_volume(char *volume_string) {
         }
 }
 
-void sb_loop_read_battery(char *battery_string) {
-        char status, capacity[4];
-        FILE *status_file, *capacity_file;
-
-        capacity_file = fopen(BATTERY_DIRECTORY "/capacity", "r");
-        status_file = fopen(BATTERY_DIRECTORY "/status", "r");
+void sb_loop_read_battery(struct bar_io *io, char *battery_string) {
+        char status[2], capacity[4] = {0};
 
-        status = fgetc(status_file);
-        fgets(capacity, 4, capacity_file);
+        sb_io_file(io, BATTERY_DIRECTORY "/capacity", capacity, sizeof capacity);
+        sb_io_file(io, BATTERY_DIRECTORY "/status", status, sizeof status);
 
         if (capacity[2] == '0') {
                 // battery full
@@ -372,15 +1345,12 @@ void sb_loop_read_battery(char *battery_string) {
                 }
                 battery_string[9] = '%';
                 // Display if the battery is charging
-                if (status == 'C') {
+                if (status[0] == 'C') {
                         strcpy(battery_string + 10, "#5Chg");
                 } else {
                         battery_string[10] = '\0';
                 }
         }
-
-        fclose(status_file);
-        fclose(capacity_file);
 }
 
 int sb_str_to_int(char *str) {
@@ -391,19 +1361,15 @@ int sb_str_to_int(char *str) {
         return n;
 }
 
-void sb_loop_read_light(char *light_string) {
-        FILE *brightness_file, *max_file;
+void sb_loop_read_light(struct bar_io *io, char *light_string) {
         int brightness, max, light;
         char buffer[100];
 
-        brightness_file = fopen(LIGHT_DIRECTORY "/brightness", "r");
-        max_file = fopen(LIGHT_DIRECTORY "/max_brightness", "r");
-
-        fgets(buffer, sizeof buffer, brightness_file);
+        sb_io_file(io, LIGHT_DIRECTORY "/brightness", buffer, sizeof buffer);
         brightness = sb_str_to_int(buffer);
-        fgets(buffer, sizeof buffer, max_file);
+        sb_io_file(io, LIGHT_DIRECTORY "/max_brightness", buffer, sizeof buffer);
         max = sb_str_to_int(buffer);
-        light = 100 * brightness / max;
+        light = max > 0 ? 100 * brightness / max : 0;
 
         strcpy(light_string + 5, "#1");
         if (light == 100) {
@@ -417,54 +1383,1057 @@ void sb_loop_read_light(char *light_string) {
                 light_string[8] = light % 10 + '0';
                 light_string[9] = '%';
         }
+}
+
+/*
+ * Opens a NETLINK_ROUTE socket, optionally subscribed to groups
+ */
+int sb_netlink_open(unsigned int groups) {
+        struct sockaddr_nl addr;
+        int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+
+        if (fd == -1) {
+                printf("netlink socket failed\n");
+                exit(EXIT_FAILURE);
+        }
+
+        memset(&addr, 0, sizeof addr);
+        addr.nl_family = AF_NETLINK;
+        addr.nl_groups = groups;
+        if (bind(fd, (struct sockaddr *)&addr, sizeof addr) == -1) {
+                printf("netlink bind failed\n");
+                exit(EXIT_FAILURE);
+        }
 
-        fclose(brightness_file);
-        fclose(max_file);
+        return fd;
 }
 
-void sb_loop_main(struct sam_bar *sam_bar) {
-        struct pollfd pollfds[SB_POLL_MAX];
+/*
+ * True if a link's IFLA_LINKINFO names a kind, which only drivers for
+ * virtual links (bridge, veth, tun, wireguard, ...) fill in
+ */
+int sb_netlink_is_virtual(struct rtattr *linkinfo) {
+        struct rtattr *attr = RTA_DATA(linkinfo);
+        int attr_len = RTA_PAYLOAD(linkinfo);
+
+        for (; RTA_OK(attr, attr_len); attr = RTA_NEXT(attr, attr_len)) {
+                if (attr->rta_type == IFLA_INFO_KIND)
+                        return true;
+        }
+        return false;
+}
+
+/*
+ * Dumps every link with RTM_GETLINK and sums the IFLA_STATS64 byte counters
+ * of the physical interfaces into rx and tx
+ * Virtual links only relay traffic that already went over a physical one
+ * (or never leaves the machine), so counting them would add it up twice;
+ * a physical link enslaved to a bridge is still counted, the bridge isn't
+ * Returns the number of physical interfaces which are up and running,
+ * or -1 on error
+ */
+int sb_netlink_query(struct network_info *info,
+                unsigned long long *rx, unsigned long long *tx) {
+        struct {
+                struct nlmsghdr header;
+                struct ifinfomsg message;
+        } request;
+        // netlink messages are 4 byte aligned, so keep the buffer aligned too
+        unsigned int buffer[NETLINK_BUF_SIZE / sizeof(unsigned int)];
+        int running = 0;
+
+        memset(&request, 0, sizeof request);
+        request.header.nlmsg_len = NLMSG_LENGTH(sizeof request.message);
+        request.header.nlmsg_type = RTM_GETLINK;
+        request.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+        request.header.nlmsg_seq = ++info->seq;
+        request.message.ifi_family = AF_UNSPEC;
+
+        if (send(info->query_fd, &request, request.header.nlmsg_len, 0) == -1)
+                return -1;
+
+        *rx = *tx = 0;
+        for (;;) {
+                struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+                int len = recv(info->query_fd, buffer, sizeof buffer, 0);
+
+                if (len <= 0)
+                        return -1;
+
+                for (; NLMSG_OK(header, (unsigned int)len);
+                                header = NLMSG_NEXT(header, len)) {
+                        struct ifinfomsg *message;
+                        struct rtattr *attr, *stats_attr = NULL;
+                        int attr_len, virtual = false;
+
+                        if (header->nlmsg_seq != info->seq)
+                                continue;
+                        if (header->nlmsg_type == NLMSG_DONE)
+                                return running;
+                        if (header->nlmsg_type == NLMSG_ERROR)
+                                return -1;
+                        if (header->nlmsg_type != RTM_NEWLINK)
+                                continue;
+
+                        message = NLMSG_DATA(header);
+                        if (message->ifi_flags & IFF_LOOPBACK)
+                                continue;
+
+                        attr = IFLA_RTA(message);
+                        attr_len = IFLA_PAYLOAD(header);
+                        for (; RTA_OK(attr, attr_len);
+                                        attr = RTA_NEXT(attr, attr_len)) {
+                                if (attr->rta_type == IFLA_STATS64)
+                                        stats_attr = attr;
+                                else if (attr->rta_type == IFLA_LINKINFO)
+                                        virtual = sb_netlink_is_virtual(attr);
+                        }
+                        if (virtual)
+                                continue;
+
+                        if ((message->ifi_flags & (IFF_UP | IFF_RUNNING))
+                                        == (IFF_UP | IFF_RUNNING))
+                                running++;
+                        if (stats_attr != NULL) {
+                                struct rtnl_link_stats64 stats;
+                                // the payload is only 4 byte aligned
+                                memcpy(&stats, RTA_DATA(stats_attr), sizeof stats);
+                                *rx += stats.rx_bytes;
+                                *tx += stats.tx_bytes;
+                        }
+                }
+        }
+}
+
+/*
+ * Writes a rate in bytes/second as exactly 3 characters, e.g. "12K";
+ * 100 to 1023 of a unit are shown as tenths of the next one, e.g. ".3M"
+ */
+void sb_format_rate(char *rate_string, unsigned long rate) {
+        const char units[] = "BKMGT";
+        int unit = 0;
+
+        while (rate >= 100 && unit < (int)sizeof units - 2) {
+                if (rate < 1024) {
+                        // round to the nearest tenth of the next unit
+                        unsigned long tenths = (rate * 10 + 512) / 1024;
+                        if (tenths < 10) {
+                                rate_string[0] = '.';
+                                rate_string[1] = tenths + '0';
+                                rate_string[2] = units[unit + 1];
+                                return;
+                        }
+                        rate = 1024;
+                }
+                rate /= 1024;
+                unit++;
+        }
+        if (rate >= 100)
+                rate = 99;
+
+        rate_string[0] = rate < 10 ? ' ' : rate / 10 + '0';
+        rate_string[1] = rate % 10 + '0';
+        rate_string[2] = units[unit];
+}
+
+void sb_loop_write_network(struct network_info *info, char *network_string) {
+        strcpy(network_string, "#1Net");
+        if (!info->up) {
+                strcpy(network_string + 5, "#1Off");
+                return;
+        }
+
+        network_string[5] = '#';
+        network_string[6] = sb_pen_to_char(SB_GREEN_N);
+        sb_format_rate(network_string + 7, info->rx_rate);
+        network_string[10] = '#';
+        network_string[11] = sb_pen_to_char(SB_CYAN_B);
+        sb_format_rate(network_string + 12, info->tx_rate);
+        network_string[15] = '\0';
+}
+
+/*
+ * sb_netlink_query, through the trace
+ */
+int sb_io_netlink(struct bar_io *io, struct network_info *info,
+                unsigned long long *rx, unsigned long long *tx) {
+        struct { int64_t running; uint64_t rx, tx; } sample = {0, 0, 0};
+
+        if (io->replay != NULL) {
+                sb_io_get(io, SB_INPUT_NETLINK, &sample, sizeof sample);
+        } else {
+                unsigned long long live_rx = 0, live_tx = 0;
+                sample.running = sb_netlink_query(info, &live_rx, &live_tx);
+                sample.rx = live_rx;
+                sample.tx = live_tx;
+                sb_io_put(io, SB_INPUT_NETLINK, &sample, sizeof sample);
+        }
+        *rx = sample.rx;
+        *tx = sample.tx;
+        return sample.running;
+}
+
+/*
+ * Samples the byte counters and computes the rates from the delta
+ * since the last sample, seconds ago
+ */
+void sb_loop_read_network(struct bar_io *io, struct network_info *info,
+                char *network_string, unsigned long seconds) {
+        unsigned long long rx, tx;
+        int running = sb_io_netlink(io, info, &rx, &tx);
+
+        if (running == -1)
+                return;
+
+        // counters go backwards when an interface disappears; don't show junk
+        info->rx_rate = rx >= info->rx_bytes && seconds > 0
+                ? (rx - info->rx_bytes) / seconds : 0;
+        info->tx_rate = tx >= info->tx_bytes && seconds > 0
+                ? (tx - info->tx_bytes) / seconds : 0;
+        info->rx_bytes = rx;
+        info->tx_bytes = tx;
+        info->up = running > 0;
+        sb_loop_write_network(info, network_string);
+}
+
+/*
+ * Drains the link notifications
+ * Returns true if any of them could have changed whether a link is up
+ */
+int sb_netlink_drain(struct network_info *info) {
+        unsigned int buffer[NETLINK_BUF_SIZE / sizeof(unsigned int)];
+        int len, interesting = false;
+
+        while ((len = recv(info->event_fd, buffer, sizeof buffer, MSG_DONTWAIT)) > 0) {
+                struct nlmsghdr *header = (struct nlmsghdr *)buffer;
+
+                for (; NLMSG_OK(header, (unsigned int)len);
+                                header = NLMSG_NEXT(header, len)) {
+                        struct rtattr *attr;
+                        int attr_len, wireless = false;
+
+                        if (header->nlmsg_type != RTM_NEWLINK) {
+                                interesting = true;
+                                continue;
+                        }
+                        // wifi drivers send a steady stream of these,
+                        // none of which change whether the link is up
+                        attr = IFLA_RTA((struct ifinfomsg *)NLMSG_DATA(header));
+                        attr_len = IFLA_PAYLOAD(header);
+                        for (; RTA_OK(attr, attr_len);
+                                        attr = RTA_NEXT(attr, attr_len)) {
+                                if (attr->rta_type == IFLA_WIRELESS)
+                                        wireless = true;
+                        }
+                        interesting |= !wireless;
+                }
+        }
+        return interesting;
+}
+
+/*
+ * sb_netlink_drain, through the trace
+ */
+int sb_io_link(struct bar_io *io, struct network_info *info) {
+        uint8_t interesting = false;
+
+        if (io->replay != NULL) {
+                sb_io_get(io, SB_INPUT_LINK, &interesting, sizeof interesting);
+        } else {
+                interesting = sb_netlink_drain(info);
+                sb_io_put(io, SB_INPUT_LINK, &interesting, sizeof interesting);
+        }
+        return interesting;
+}
+
+/*
+ * Refreshes the up/down state after link notifications,
+ * without touching the byte counters the rates are computed from
+ * Returns true if that changed what the segment shows
+ */
+int sb_loop_read_link(struct bar_io *io, struct network_info *info,
+                char *network_string) {
+        unsigned long long rx, tx;
+        int running, was_up = info->up;
+
+        if (!sb_io_link(io, info))
+                return false;
+        running = sb_io_netlink(io, info, &rx, &tx);
+        if (running == -1)
+                return false;
+        info->up = running > 0;
+        if (info->up == was_up)
+                return false;
+        sb_loop_write_network(info, network_string);
+        return true;
+}
+
+/*
+ * Writes a percentage as a pen followed by 3 characters, e.g. "#2 5%"
+ */
+void sb_format_percent(char *percent_string, int percent) {
+        percent_string[0] = '#';
+        if (percent < 50)
+                percent_string[1] = sb_pen_to_char(SB_GREEN_N);
+        else if (percent < 80)
+                percent_string[1] = sb_pen_to_char(SB_YELLOW_N);
+        else
+                percent_string[1] = sb_pen_to_char(SB_RED_N);
+
+        if (percent >= 100) {
+                strcpy(percent_string + 2, "Max");
+                return;
+        }
+        percent_string[2] = percent < 10 ? ' ' : percent / 10 + '0';
+        percent_string[3] = percent % 10 + '0';
+        percent_string[4] = '%';
+}
+
+void sb_loop_read_load(struct bar_io *io, struct load_info *info,
+                char *load_string) {
+        char buffer[PROC_BUF_SIZE];
+        unsigned long long busy, total;
+        int cpu = 0;
+
+        strcpy(load_string, "#1Cpu");
+        if (sb_io_pread(io, info->stat_fd, buffer, sizeof buffer)) {
+                sb_parse_stat(buffer, &busy, &total);
+                if (total > info->total && busy >= info->busy)
+                        cpu = 100 * (busy - info->busy) / (total - info->total);
+                info->busy = busy;
+                info->total = total;
+        }
+        sb_format_percent(load_string + 5, cpu);
+
+        strcpy(load_string + 10, "#1Mem");
+        if (sb_io_pread(io, info->meminfo_fd, buffer, sizeof buffer))
+                sb_format_percent(load_string + 15, sb_parse_meminfo(buffer));
+        else
+                sb_format_percent(load_string + 15, 0);
+        load_string[20] = '\0';
+}
+
+/*
+ * Toggles the window to match the hide state requested on stdin
+ */
+void sb_loop_handle_stdin(struct sam_bar *sam_bar, struct bar_state *state) {
+        int do_hide = strstr(state->segments[SB_SEGMENT_STDIN], "XXX") != NULL;
+        // state changed
+        if (do_hide != state->hide) {
+                state->hide = do_hide;
+                if (do_hide) {
+                        xcb_unmap_window(
+                                sam_bar->connection,
+                                sam_bar->window
+                        );
+                } else {
+                        xcb_map_window(
+                                sam_bar->connection,
+                                sam_bar->window
+                        );
+                }
+        }
+}
+
+unsigned long long sb_timespec_to_ns(const struct timespec *ts) {
+        return ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+void sb_latency_push(struct latency_samples *samples, unsigned long long ns) {
+        if (samples->count == samples->max) {
+                samples->max = samples->max ? 2 * samples->max : 1024;
+                samples->ns = realloc(samples->ns, samples->max * sizeof *samples->ns);
+        }
+        samples->ns[samples->count++] = ns;
+}
+
+int sb_compare_ull(const void *a, const void *b) {
+        unsigned long long x = *(const unsigned long long *)a,
+                           y = *(const unsigned long long *)b;
+        return (x > y) - (x < y);
+}
+
+void sb_report_latency(FILE *out, const char *name,
+                struct latency_samples *samples) {
+        unsigned long long *latencies = samples->ns;
+        size_t count = samples->count;
+
+        if (count == 0) {
+                fprintf(out, "%s: no samples\n", name);
+                return;
+        }
+        qsort(latencies, count, sizeof *latencies, sb_compare_ull);
+        fprintf(
+                out,
+                "%s: %zu samples, p50 %lluus p90 %lluus p99 %lluus max %lluus\n",
+                name, count,
+                latencies[(count - 1) * 50 / 100] / 1000,
+                latencies[(count - 1) * 90 / 100] / 1000,
+                latencies[(count - 1) * 99 / 100] / 1000,
+                latencies[count - 1] / 1000
+        );
+}
+
+/*
+ * Frees the first count buffers
+ */
+void sb_probe_free_buffers(struct latency_probe *probe, struct sam_bar *sam_bar,
+                int count) {
+        for (int i = 0; i < count; i++) {
+                xcb_render_free_picture(sam_bar->connection, probe->buffers[i].picture);
+                xcb_free_pixmap(sam_bar->connection, probe->buffers[i].pixmap);
+        }
+}
+
+/*
+ * Creates the buffers at the window's size
+ * Returns false if the server won't give us them
+ */
+int sb_probe_create_buffers(struct latency_probe *probe, struct sam_bar *sam_bar) {
+        xcb_connection_t *connection = sam_bar->connection;
+
+        for (int i = 0; i < PROBE_BUFFERS; i++) {
+                xcb_generic_error_t *error;
+
+                probe->buffers[i].pixmap = xcb_generate_id(connection);
+                probe->buffers[i].picture = xcb_generate_id(connection);
+                probe->buffers[i].idle = true;
+                error = xcb_request_check(connection, xcb_create_pixmap_checked(
+                        connection,
+                        32, // the window's depth
+                        probe->buffers[i].pixmap, sam_bar->window,
+                        sam_bar->width, sam_bar->height
+                ));
+                if (error == NULL) {
+                        error = xcb_request_check(connection, xcb_render_create_picture_checked(
+                                connection,
+                                probe->buffers[i].picture,
+                                probe->buffers[i].pixmap,
+                                probe->format,
+                                0, NULL
+                        ));
+                        if (error != NULL)
+                                xcb_free_pixmap(connection, probe->buffers[i].pixmap);
+                }
+                if (error != NULL) {
+                        free(error);
+                        sb_probe_free_buffers(probe, sam_bar, i);
+                        return false;
+                }
+        }
+        probe->width = sam_bar->width;
+        probe->current = 0;
+        return true;
+}
+
+/*
+ * Sets up the probe if the server has the Present extension
+ * Returns false if it doesn't
+ */
+int sb_probe_init(struct latency_probe *probe, struct sam_bar *sam_bar) {
+        const xcb_query_extension_reply_t *extension;
+        xcb_present_query_version_reply_t *version;
+
+        memset(probe, 0, sizeof *probe);
+        extension = xcb_get_extension_data(sam_bar->connection, &xcb_present_id);
+        if (extension == NULL || !extension->present)
+                return false;
+        version = xcb_present_query_version_reply(
+                sam_bar->connection,
+                xcb_present_query_version(sam_bar->connection, 1, 0),
+                ERROR
+        );
+        if (version == NULL)
+                return false;
+        free(version);
+
+        probe->present_opcode = extension->major_opcode;
+        probe->eid = xcb_generate_id(sam_bar->connection);
+        xcb_present_select_input(
+                sam_bar->connection,
+                probe->eid,
+                sam_bar->window,
+                XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY
+                        | XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY
+        );
+
+        probe->format = xcb_render_util_find_standard_format(
+                xcb_render_util_query_formats(sam_bar->connection),
+                XCB_PICT_STANDARD_ARGB_32
+        )->id;
+        probe->use_pixmaps = sb_probe_create_buffers(probe, sam_bar);
+        if (!probe->use_pixmaps)
+                fprintf(stderr, "can't create Present buffers, probing with NotifyMSC\n");
+        return true;
+}
+
+/*
+ * Attributes the frame just drawn to what caused it
+ * With buffers, that's the frame sb_probe_end_frame presented; otherwise
+ * asks for a notification on the first vblank after the server handled it,
+ * which without a compositor is when it is scanned out, with one it is a
+ * lower bound
+ * Assumptions:
+ * - sources is the SB_SEGMENT bitmask of what caused this frame
+ */
+void sb_probe_frame(struct latency_probe *probe, struct sam_bar *sam_bar,
+                unsigned long long event_ns, unsigned int sources) {
+        uint32_t serial;
+
+        if (probe->use_pixmaps) {
+                if (!probe->presented)
+                        return;
+                serial = probe->serial;
+        } else {
+                serial = ++probe->serial;
+                // target 0, divisor 1: the next msc after the requests before this one
+                xcb_present_notify_msc(sam_bar->connection, sam_bar->window, serial, 0, 1, 0);
+                xcb_flush(sam_bar->connection);
+        }
+        probe->pending[serial % PROBE_PENDING].serial = serial;
+        probe->pending[serial % PROBE_PENDING].sources = sources;
+        probe->pending[serial % PROBE_PENDING].event_ns = event_ns;
+}
+
+/*
+ * Turns a Present completion into latency samples, and marks buffers
+ * the server is done with as idle
+ */
+void sb_probe_handle_event(struct latency_probe *probe, xcb_generic_event_t *event) {
+        xcb_present_complete_notify_event_t *complete =
+                (xcb_present_complete_notify_event_t *)event;
+        uint8_t kind = probe->use_pixmaps
+                ? XCB_PRESENT_COMPLETE_KIND_PIXMAP
+                : XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC;
+        unsigned int slot = complete->serial % PROBE_PENDING;
+        unsigned long long ust_ns, event_ns, latency;
+
+        if (complete->extension != probe->present_opcode)
+                return;
+
+        if (complete->event_type == XCB_PRESENT_EVENT_IDLE_NOTIFY) {
+                xcb_present_idle_notify_event_t *idle =
+                        (xcb_present_idle_notify_event_t *)event;
+                for (int i = 0; i < PROBE_BUFFERS; i++) {
+                        if (probe->buffers[i].pixmap == idle->pixmap)
+                                probe->buffers[i].idle = true;
+                }
+                return;
+        }
+
+        if (complete->event_type != XCB_PRESENT_EVENT_COMPLETE_NOTIFY
+                        || complete->kind != kind
+                        || complete->serial != probe->pending[slot].serial)
+                return;
+        probe->pending[slot].serial = 0;
+        // a skipped frame was replaced before it was ever shown
+        if (complete->mode == XCB_PRESENT_COMPLETE_MODE_SKIP)
+                return;
+
+        // ust is CLOCK_MONOTONIC in microseconds
+        ust_ns = complete->ust * 1000ULL;
+        event_ns = probe->pending[slot].event_ns;
+        latency = ust_ns > event_ns ? ust_ns - event_ns : 0;
+        for (int i = 0; i < SB_SEGMENT_MAX; i++) {
+                if ((probe->pending[slot].sources >> i) & 1)
+                        sb_latency_push(&probe->samples[i], latency);
+        }
+}
+
+/*
+ * Points the drawing at an idle buffer, waiting for the server to be done
+ * with one if it has to; a no-op without buffers
+ */
+void sb_probe_begin_frame(struct latency_probe *probe, struct sam_bar *sam_bar) {
+        int next;
+
+        probe->presented = false;
+        if (!probe->use_pixmaps)
+                return;
+        if (probe->width != sam_bar->width) {
+                // a config reload resized the window
+                sb_probe_free_buffers(probe, sam_bar, PROBE_BUFFERS);
+                probe->use_pixmaps = sb_probe_create_buffers(probe, sam_bar);
+                if (!probe->use_pixmaps) {
+                        fprintf(stderr, "can't create Present buffers, probing with NotifyMSC\n");
+                        return;
+                }
+        }
+
+        for (;;) {
+                xcb_generic_event_t *event;
+
+                next = (probe->current + 1) % PROBE_BUFFERS;
+                if (!probe->buffers[next].idle && probe->buffers[probe->current].idle)
+                        next = probe->current;
+                if (probe->buffers[next].idle)
+                        break;
+
+                event = xcb_wait_for_event(sam_bar->connection);
+                if (event == NULL) {
+                        // the connection is gone, so is the point of drawing
+                        return;
+                }
+                // only Present events matter here; an Expose can be
+                // dropped, this frame repaints the whole window anyway
+                if ((event->response_type & ~0x80) == XCB_GE_GENERIC)
+                        sb_probe_handle_event(probe, event);
+                free(event);
+        }
+
+        probe->current = next;
+        sam_bar->target = probe->buffers[next].pixmap;
+        sam_bar->target_picture = probe->buffers[next].picture;
+        // the buffer holds an older frame, not what is on screen
+        if (sam_bar->shm != NULL)
+                sam_bar->shm->full_damage = true;
+}
+
+/*
+ * Presents the buffer just drawn at the next vblank,
+ * and points the drawing back at the window
+ */
+void sb_probe_end_frame(struct latency_probe *probe, struct sam_bar *sam_bar) {
+        if (sam_bar->target == sam_bar->window)
+                return;
+
+        probe->buffers[probe->current].idle = false;
+        xcb_present_pixmap(
+                sam_bar->connection,
+                sam_bar->window,
+                probe->buffers[probe->current].pixmap,
+                ++probe->serial,
+                0, 0, // valid and update: the whole pixmap
+                0, 0, // x, y offset
+                0, // any crtc
+                0, 0, // no wait or idle fence, IdleNotify is enough
+                XCB_PRESENT_OPTION_NONE,
+                0, 0, 0, // target 0, divisor 0: the next msc
+                0, NULL
+        );
+        probe->presented = true;
+        sam_bar->target = sam_bar->window;
+        sam_bar->target_picture = sam_bar->picture;
+}
+
+/*
+ * Drains X events, handing Present events to the probe (if any)
+ * Returns true if part of the window was exposed and has to be redrawn
+ */
+int sb_loop_read_x(struct sam_bar *sam_bar) {
+        xcb_generic_event_t *event;
+        int exposed = false;
+
+        while ((event = xcb_poll_for_event(sam_bar->connection)) != NULL) {
+                switch (event->response_type & ~0x80) {
+                case XCB_EXPOSE:
+                        exposed = true;
+                        break;
+                case XCB_GE_GENERIC:
+                        if (sam_bar->probe != NULL)
+                                sb_probe_handle_event(sam_bar->probe, event);
+                        break;
+                }
+                free(event);
+        }
+
+        // the server wiped what was there, so every row has to be sent again
+        if (exposed && sam_bar->shm != NULL)
+                sam_bar->shm->full_damage = true;
+        return exposed;
+}
+
+void sb_probe_report(struct latency_probe *probe, FILE *out) {
+        char name[64];
+
+        for (int i = 0; i < SB_SEGMENT_MAX; i++) {
+                snprintf(name, sizeof name, "%s to vblank", SB_SEGMENT_NAME[i]);
+                sb_report_latency(out, name, &probe->samples[i]);
+        }
+        fflush(out);
+}
+
+void sb_probe_destroy(struct latency_probe *probe, struct sam_bar *sam_bar) {
+        if (probe->use_pixmaps)
+                sb_probe_free_buffers(probe, sam_bar, PROBE_BUFFERS);
+        for (int i = 0; i < SB_SEGMENT_MAX; i++)
+                free(probe->samples[i].ns);
+}
+
+void sb_loop_draw(struct sam_bar *sam_bar, const struct bar_state *state) {
+        const char *battery_string = state->segments[SB_SEGMENT_BATTERY];
+        int y = sam_bar->height,
+            font_height = sam_bar->config.font_height,
+            line_padding = sam_bar->config.line_padding;
+
+        if (state->hide) {
+                xcb_clear_area(
+                        sam_bar->connection,
+                        0, sam_bar->window,
+                        0, 0,
+                        sam_bar->width, sam_bar->height
+                );
+                xcb_flush(sam_bar->connection);
+                // the window contents are gone once it's unmapped
+                if (sam_bar->shm != NULL)
+                        sam_bar->shm->full_damage = true;
+                return;
+        }
+
+        if (sam_bar->probe != NULL)
+                sb_probe_begin_frame(sam_bar->probe, sam_bar);
+
+        // clear the screen
+        if (sam_bar->shm != NULL) {
+                sb_shm_clear(sam_bar);
+        } else if (sam_bar->target != sam_bar->window) {
+                // a pixmap has no background to clear to
+                uint32_t background = sam_bar->config.background;
+                xcb_render_color_t color = {
+                        (background >> 16 & 0xFF) * 0x101,
+                        (background >> 8 & 0xFF) * 0x101,
+                        (background & 0xFF) * 0x101,
+                        (background >> 24) * 0x101,
+                };
+                xcb_rectangle_t rectangle = { 0, 0, sam_bar->width, sam_bar->height };
+                xcb_render_fill_rectangles(
+                        sam_bar->connection,
+                        XCB_RENDER_PICT_OP_SRC,
+                        sam_bar->target_picture,
+                        color,
+                        1, &rectangle
+                );
+        } else {
+                xcb_clear_area(
+                        sam_bar->connection,
+                        0, sam_bar->window,
+                        0, 0,
+                        sam_bar->width, sam_bar->height
+                );
+        }
+
+        // write the text
+        sb_draw_text(sam_bar, font_height, state->segments[SB_SEGMENT_STDIN]);
+        y -= 4 * font_height + 5 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_TIME]);
+        y -= 4 * font_height + 3 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_NETWORK]);
+        y -= 5 * font_height + 4 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_LOAD]);
+        y -= 3 * font_height + 2 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_VOLUME]);
+        y -= 3 * font_height + 2 * line_padding;
+        if (battery_string[10] != '\0') {
+                y -= font_height + line_padding;
+        }
+        sb_draw_text(sam_bar, y, battery_string);
+        y -= 3 * font_height + 2 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_LIGHT]);
+        y -= 1 * font_height + 1 * line_padding;
+        sb_draw_text(sam_bar, y, state->segments[SB_SEGMENT_RECORDING]);
+        if (sam_bar->shm != NULL)
+                sb_shm_push(sam_bar);
+        if (sam_bar->probe != NULL)
+                sb_probe_end_frame(sam_bar->probe, sam_bar);
+        xcb_flush(sam_bar->connection);
+}
+
+/*
+ * Sets up what the live loop and replay have in common;
+ * fds are left at -1 for the live loop to open
+ */
+void sb_loop_init(struct bar_loop *loop, struct sam_bar *sam_bar) {
+        struct bar_state *state = &loop->state;
+
+        memset(loop, 0, sizeof *loop);
+        loop->sam_bar = sam_bar;
+        state->hide = -1;
+        for (int i = 0; i < SB_POLL_MAX; i++) {
+                loop->pollfds[i].fd = -1;
+                loop->pollfds[i].events = POLLIN;
+        }
+        loop->network_info.query_fd = loop->network_info.event_fd = -1;
+        loop->load_info.stat_fd = loop->load_info.meminfo_fd = -1;
+
+        strcpy(state->segments[SB_SEGMENT_RECORDING], "#4 ● ");
+        strcpy(state->segments[SB_SEGMENT_VOLUME], "#1Vol");
+        strcpy(state->segments[SB_SEGMENT_BATTERY], "#1Bat");
+        strcpy(state->segments[SB_SEGMENT_LIGHT], "#1Lit");
+}
+
+/*
+ * The sensor reads done once, before the first wakeup
+ */
+void sb_loop_read_all(struct bar_loop *loop) {
+        struct bar_state *state = &loop->state;
+
+        sb_loop_read_volume(&loop->io, state->segments[SB_SEGMENT_VOLUME]);
+        sb_loop_read_battery(&loop->io, state->segments[SB_SEGMENT_BATTERY]);
+        sb_loop_read_light(&loop->io, state->segments[SB_SEGMENT_LIGHT]);
+        sb_loop_read_network(
+                &loop->io, &loop->network_info,
+                state->segments[SB_SEGMENT_NETWORK], 0
+        );
+        sb_loop_read_load(
+                &loop->io, &loop->load_info,
+                state->segments[SB_SEGMENT_LOAD]
+        );
+        sb_loop_read_recording(&loop->io, state->segments[SB_SEGMENT_RECORDING]);
+}
+
+/*
+ * Handles a wakeup for the poll index source, then does the periodic
+ * sensor reads; every input comes through loop->io, so replay runs exactly
+ * this and decides what to redraw itself
+ * Leaves the decision in loop->redraw and loop->triggers
+ * Returns false once stdin is closed
+ */
+int sb_loop_handle(struct bar_loop *loop, int source) {
+        struct bar_state *state = &loop->state;
+        struct pollfd *pollfds = loop->pollfds;
+        int redraw = false;
+        // only the segments which caused a redraw
+        unsigned int triggers = 0;
+        char *time_string = state->segments[SB_SEGMENT_TIME],
+             *stdin_string = state->segments[SB_SEGMENT_STDIN],
+             *volume_string = state->segments[SB_SEGMENT_VOLUME],
+             *battery_string = state->segments[SB_SEGMENT_BATTERY],
+             *light_string = state->segments[SB_SEGMENT_LIGHT],
+             *network_string = state->segments[SB_SEGMENT_NETWORK],
+             *load_string = state->segments[SB_SEGMENT_LOAD],
+             *recording_string = state->segments[SB_SEGMENT_RECORDING];
+
+        if (source == SB_POLL_STDIN) {
+                if (!sb_io_stdin(&loop->io, stdin_string, STDIN_LINE_LENGTH))
+                        return false;
+                sb_loop_handle_stdin(loop->sam_bar, state);
+                triggers |= 1 << SB_SEGMENT_STDIN;
+                redraw = true;
+        } else if (source == SB_POLL_TIMER) {
+                uint64_t num;
+                time_t rawtime;
+                struct tm *info;
+                char prev_minute;
+
+                num = sb_io_timer(&loop->io, pollfds[SB_POLL_TIMER].fd);
+                loop->elapsed += num;
+
+                prev_minute = time_string[DATE_BUF_SIZE - 2];
+                rawtime = sb_io_time(&loop->io);
+                info = localtime(&rawtime);
+                strftime(
+                        time_string,
+                        DATE_BUF_SIZE,
+                        "#1%b#1 %d#1%a#1 %I#1 %M",
+                        info
+                );
+                redraw = prev_minute != time_string[DATE_BUF_SIZE - 2];
+                if (redraw)
+                        triggers |= 1 << SB_SEGMENT_TIME;
+
+                // only redraw for the network when the rates changed
+                {
+                        char prev_network[NETWORK_LENGTH];
+                        strcpy(prev_network, network_string);
+                        sb_loop_read_network(
+                                &loop->io, &loop->network_info,
+                                network_string, num
+                        );
+                        if (strcmp(prev_network, network_string) != 0) {
+                                triggers |= 1 << SB_SEGMENT_NETWORK;
+                                redraw = true;
+                        }
+                }
+                {
+                        char prev_load[LOAD_LENGTH];
+                        strcpy(prev_load, load_string);
+                        sb_loop_read_load(&loop->io, &loop->load_info, load_string);
+                        if (strcmp(prev_load, load_string) != 0) {
+                                triggers |= 1 << SB_SEGMENT_LOAD;
+                                redraw = true;
+                        }
+                }
+        } else if (source == SB_POLL_VOLUME) {
+                sb_io_drain(&loop->io, pollfds[SB_POLL_VOLUME].fd);
+                if (loop->just_pamixer) {
+                        loop->just_pamixer = false;
+                } else {
+                        sb_loop_read_volume(&loop->io, volume_string);
+                        triggers |= 1 << SB_SEGMENT_VOLUME;
+                        loop->just_pamixer = true;
+                        redraw = true;
+                }
+        } else if (source == SB_POLL_BATTERY) {
+                // read the battery when the status changes
+                sb_io_drain(&loop->io, pollfds[SB_POLL_BATTERY].fd);
+                sb_loop_read_battery(&loop->io, battery_string);
+                triggers |= 1 << SB_SEGMENT_BATTERY;
+                redraw = true;
+        } else if (source == SB_POLL_LIGHT) {
+                sb_io_drain(&loop->io, pollfds[SB_POLL_LIGHT].fd);
+                sb_loop_read_light(&loop->io, light_string);
+                triggers |= 1 << SB_SEGMENT_LIGHT;
+                redraw = true;
+        } else if (source == SB_POLL_NETWORK) {
+                if (sb_loop_read_link(&loop->io, &loop->network_info, network_string)) {
+                        triggers |= 1 << SB_SEGMENT_NETWORK;
+                        redraw = true;
+                }
+        }
+
+        // read battery every 30 seconds
+        if (loop->elapsed % 30 == 0) {
+                char prev_battery[BATTERY_LENGTH];
+                strcpy(prev_battery, battery_string);
+                sb_loop_read_battery(&loop->io, battery_string);
+                // this runs on every wakeup in that second, so it
+                // only caused the frame if the reading moved
+                if (strcmp(prev_battery, battery_string) != 0)
+                        triggers |= 1 << SB_SEGMENT_BATTERY;
+                redraw = true;
+        }
+
+        if (loop->elapsed % 5 == 0) {
+                char prev_recording = recording_string[0];
+                sb_loop_read_recording(&loop->io, recording_string);
+                if (prev_recording != recording_string[0])
+                        triggers |= 1 << SB_SEGMENT_RECORDING;
+                redraw = true;
+        }
+
+        loop->redraw = redraw;
+        loop->triggers = triggers;
+        return true;
+}
+
+/*
+ * Replays a recorded trace at its original pace: every wakeup runs the
+ * same handler it did live, with stdin, the clock and the sensors served
+ * from the trace, and the handler decides whether to redraw
+ * Signals aren't replayed, so neither is a config reload
+ * Reports the latency from each event's scheduled arrival to the flush.
+ */
+void sb_loop_replay(struct sam_bar *sam_bar, FILE *trace) {
+        struct bar_loop loop;
+        struct timespec start, now;
+        unsigned long long start_ns, due_ns;
+        struct latency_samples latencies = {0}, server_latencies = {0};
+        uint32_t delta_us;
+        int source;
+        char magic[sizeof SB_TRACE_MAGIC];
+
+        if (fread(magic, sizeof magic, 1, trace) != 1
+                        || memcmp(magic, SB_TRACE_MAGIC, sizeof magic) != 0) {
+                fprintf(stderr, "not a sam-bar trace\n");
+                exit(EXIT_FAILURE);
+        }
+
+        sb_loop_init(&loop, sam_bar);
+        loop.io.replay = trace;
+        sb_loop_read_all(&loop);
+        xcb_map_window(sam_bar->connection, sam_bar->window);
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        start_ns = due_ns = sb_timespec_to_ns(&start);
+        while (sb_io_next_event(&loop.io, &delta_us, &source)) {
+                struct timespec due;
+
+                due_ns += delta_us * 1000ULL;
+                due.tv_sec = due_ns / 1000000000ULL;
+                due.tv_nsec = due_ns % 1000000000ULL;
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL);
+
+                if (!sb_loop_handle(&loop, source))
+                        break;
+
+                if (xcb_connection_has_error(sam_bar->connection)) {
+                        fprintf(stderr, "lost the X connection\n");
+                        break;
+                }
+                if (loop.redraw) {
+                        sb_loop_draw(sam_bar, &loop.state);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        sb_latency_push(&latencies, sb_timespec_to_ns(&now) - due_ns);
+                        // flush says nothing about how long the server takes
+                        // to render, which is what differs between backends
+                        xcb_aux_sync(sam_bar->connection);
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        sb_latency_push(&server_latencies, sb_timespec_to_ns(&now) - due_ns);
+                        // repair exposed parts, outside of the measurement
+                        if (sb_loop_read_x(sam_bar))
+                                sb_loop_draw(sam_bar, &loop.state);
+                }
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        printf(
+                "replayed %llums of events\n",
+                (sb_timespec_to_ns(&now) - start_ns) / 1000000
+        );
+        sb_report_latency(stdout, "input to flush", &latencies);
+        sb_report_latency(stdout, "input to server done", &server_latencies);
+        free(latencies.ns);
+        free(server_latencies.ns);
+}
+
+/*
+ * Assumptions:
+ * - trace is either NULL or an open file that events get recorded into
+ */
+void sb_loop_main(struct sam_bar *sam_bar, FILE *trace) {
+        struct latency_probe *probe = sam_bar->probe;
+        struct bar_loop loop;
+        struct pollfd *pollfds = loop.pollfds;
         struct itimerspec ts;
-        int redraw = false, just_pamixer = false, i, hide = -1;
-        unsigned long int elapsed = 0; 
-        char time_string[DATE_BUF_SIZE] = {0},
-             stdin_string[STDIN_LINE_LENGTH] = {0},
-             volume_string[VOLUME_LENGTH] = {0},
-             battery_string[BATTERY_LENGTH] = {0},
-             light_string[LIGHT_LENGTH] = {0},
-             recording_string[] = "#4 ● ";
-        struct exec_info pactl_info;
+        unsigned long long event_ns = 0;
+
+        sb_loop_init(&loop, sam_bar);
+        loop.io.record = trace;
 
         {
                 char *pactl[] = {"/usr/bin/pactl", "subscribe", NULL};
                 int flags;
-                sb_exec(&pactl_info, pactl);
-                flags = fcntl(pactl_info.pipe[READ_FD], F_GETFL, 0);
-                fcntl(pactl_info.pipe[READ_FD], F_SETFL, flags | O_NONBLOCK);
-                strcpy(volume_string, "#1Vol");
+                sb_exec(&loop.pactl_info, pactl);
+                flags = fcntl(loop.pactl_info.pipe[READ_FD], F_GETFL, 0);
+                fcntl(loop.pactl_info.pipe[READ_FD], F_SETFL, flags | O_NONBLOCK);
         }
 
         pollfds[SB_POLL_STDIN].fd = STDIN_FILENO;
         pollfds[SB_POLL_TIMER].fd = timerfd_create(CLOCK_MONOTONIC, 0);
-        pollfds[SB_POLL_VOLUME].fd = pactl_info.pipe[READ_FD];
+        pollfds[SB_POLL_VOLUME].fd = loop.pactl_info.pipe[READ_FD];
         pollfds[SB_POLL_BATTERY].fd = inotify_init1(IN_NONBLOCK);
         pollfds[SB_POLL_LIGHT].fd = inotify_init1(IN_NONBLOCK);
-        for(i = 0; i < SB_POLL_MAX; i++)
-                pollfds[i].events = POLLIN;
+        loop.network_info.query_fd = sb_netlink_open(0);
+        loop.network_info.event_fd = sb_netlink_open(RTMGRP_LINK);
+        pollfds[SB_POLL_NETWORK].fd = loop.network_info.event_fd;
+        {
+                // SIGHUP reloads the config, SIGUSR1 dumps the latency stats
+                // and SIGTERM/SIGINT quit cleanly, all through a signalfd
+                sigset_t mask;
+                sigemptyset(&mask);
+                sigaddset(&mask, SIGHUP);
+                sigaddset(&mask, SIGUSR1);
+                sigaddset(&mask, SIGTERM);
+                sigaddset(&mask, SIGINT);
+                sigprocmask(SIG_BLOCK, &mask, NULL);
+                pollfds[SB_POLL_SIGNAL].fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+        }
+        // for Expose, and Present completions when probing
+        pollfds[SB_POLL_X].fd = xcb_get_file_descriptor(sam_bar->connection);
+        loop.load_info.stat_fd = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+        loop.load_info.meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
 
         inotify_add_watch(
                 pollfds[SB_POLL_BATTERY].fd,
                 BATTERY_DIRECTORY "/uevent",
                 IN_ACCESS
         );
-        strcpy(battery_string, "#1Bat");
 
         inotify_add_watch(
                 pollfds[SB_POLL_LIGHT].fd,
                 LIGHT_DIRECTORY "/brightness",
                 IN_MODIFY
         );
-        strcpy(light_string, "#1Lit");
 
         ts.it_interval.tv_sec = 1; // fire every second
         ts.it_interval.tv_nsec = 0;
@@ -473,135 +2442,165 @@ void sb_loop_main(struct sam_bar *sam_bar) {
         timerfd_settime(pollfds[1].fd, 0, &ts, NULL);
 
         // main loop
-        sb_loop_read_volume(volume_string);
-        sb_loop_read_battery(battery_string);
-        sb_loop_read_light(light_string);
-        sb_loop_read_recording(recording_string);
+        sb_loop_read_all(&loop);
         xcb_map_window(sam_bar->connection, sam_bar->window);
+        {
+                // the first wakeup's delay is counted from here
+                struct timespec now;
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                loop.last_event_ns = sb_timespec_to_ns(&now);
+        }
         for (;;) {
+                struct timespec now;
+                int source, reloaded = false;
+
                 // blocks until one of the fds becomes open 
                 poll(pollfds, SB_POLL_MAX, -1);
+                // when the event arrived, before any handler runs
+                clock_gettime(CLOCK_MONOTONIC, &now);
+                event_ns = sb_timespec_to_ns(&now);
                 if (pollfds[SB_POLL_STDIN].revents & POLLHUP) {
                         // stdin died, and so do we
                         break;
-                } else if (pollfds[SB_POLL_STDIN].revents & POLLIN) {
-                        int do_hide;
-                        if (fgets(stdin_string, STDIN_LINE_LENGTH, stdin) == NULL)
+                }
+                // a dead connection leaves the fd readable forever
+                if ((pollfds[SB_POLL_X].revents & (POLLHUP | POLLERR))
+                                || xcb_connection_has_error(sam_bar->connection)) {
+                        fprintf(stderr, "lost the X connection\n");
+                        break;
+                }
+                if (pollfds[SB_POLL_X].revents & POLLIN) {
+                        if (sb_loop_read_x(sam_bar))
+                                sb_loop_draw(sam_bar, &loop.state);
+                        // X events aren't events of their own;
+                        // anything else ready gets picked up next poll
+                        continue;
+                }
+
+                // the first fd that's ready is this wakeup's event,
+                // the rest get picked up next poll
+                for (source = 0; source < SB_POLL_MAX; source++) {
+                        if (source != SB_POLL_X && (pollfds[source].revents & POLLIN))
                                 break;
-                        do_hide = strstr(stdin_string, "XXX") != NULL;
-                        // state changed
-                        if (do_hide != hide) {
-                                hide = do_hide;
-                                if (do_hide) {
-                                        xcb_unmap_window(
-                                                sam_bar->connection,
-                                                sam_bar->window
-                                        );
-                                } else {
-                                        xcb_map_window(
-                                                sam_bar->connection,
-                                                sam_bar->window
-                                        );
+                }
+                if (source == SB_POLL_MAX)
+                        continue;
+
+                if (source == SB_POLL_SIGNAL) {
+                        // not in the trace, replay keeps its own config;
+                        // the wakeup still is, for the periodic reads
+                        struct signalfd_siginfo info;
+                        int quit = false;
+                        while (read(pollfds[SB_POLL_SIGNAL].fd, &info, sizeof info) == sizeof info) {
+                                switch (info.ssi_signo) {
+                                case SIGHUP:
+                                        sb_config_reload(sam_bar);
+                                        reloaded = true;
+                                        break;
+                                case SIGUSR1:
+                                        if (probe != NULL)
+                                                sb_probe_report(probe, stdout);
+                                        break;
+                                default:
+                                        // SIGTERM or SIGINT
+                                        quit = true;
+                                        break;
                                 }
                         }
-                        redraw = true;
-                } else if (pollfds[SB_POLL_TIMER].revents & POLLIN) {
-                        long num;
-                        time_t rawtime;
-                        struct tm *info;
-                        char prev_minute;
-
-                        read(pollfds[SB_POLL_TIMER].fd, &num, sizeof(long));
-                        elapsed += num;
-
-                        prev_minute = time_string[DATE_BUF_SIZE - 2];
-                        time(&rawtime);
-                        info = localtime(&rawtime);
-                        strftime(
-                                time_string,
-                                DATE_BUF_SIZE,
-                                "#1%b#1 %d#1%a#1 %I#1 %M",
-                                info
-                        );
-                        redraw = prev_minute != time_string[DATE_BUF_SIZE - 2];
-                } else if (pollfds[SB_POLL_VOLUME].revents & POLLIN) {
-                        char buffer[1024];
-
-                        while (read(pactl_info.pipe[READ_FD], buffer, sizeof buffer) > 0);
-                        if (just_pamixer) {
-                                just_pamixer = false;
-                        } else {
-                                sb_loop_read_volume(volume_string);
-                                just_pamixer = true;
-                                redraw = true;
-                        }
-                } else if (pollfds[SB_POLL_BATTERY].revents & POLLIN) {
-                        // read the battery when the status changes
-                        struct inotify_event event;
-                        read(pollfds[SB_POLL_BATTERY].fd, &event, sizeof event);
-                        sb_loop_read_battery(battery_string);
-                        redraw = true;
-                } else if (pollfds[SB_POLL_LIGHT].revents & POLLIN) {
-                        struct inotify_event event;
-                        read(pollfds[SB_POLL_LIGHT].fd, &event, sizeof event);
-                        sb_loop_read_light(light_string);
-                        redraw = true;
-                }
-
-                // read battery every 30 seconds
-                if (elapsed % 30 == 0) {
-                        sb_loop_read_battery(battery_string);
-                        redraw = true;
+                        if (quit)
+                                break;
                 }
 
-                if (elapsed % 5 == 0) {
-                        sb_loop_read_recording(recording_string);
-                        redraw = true;
+                sb_io_event(&loop.io, &loop.last_event_ns, event_ns, source);
+                if (!sb_loop_handle(&loop, source))
+                        break;
+                // so a bar that gets killed still leaves a replayable trace
+                if (trace != NULL)
+                        fflush(trace);
+
+                if (loop.redraw || reloaded) {
+                        sb_loop_draw(sam_bar, &loop.state);
+                        if (probe != NULL && !loop.state.hide && loop.triggers != 0)
+                                sb_probe_frame(probe, sam_bar, event_ns, loop.triggers);
                 }
 
-                if (redraw && hide) {
-                        xcb_clear_area(
-                                sam_bar->connection,
-                                0, sam_bar->window,
-                                0, 0,
-                                sam_bar->width, sam_bar->height
-                        );
-                        xcb_flush(sam_bar->connection);
-                } else if (redraw && !hide) {
-                        int y = sam_bar->height;
-                        // clear the screen
-                        xcb_clear_area(
-                                sam_bar->connection,
-                                0, sam_bar->window,
-                                0, 0,
-                                sam_bar->width, sam_bar->height
-                        );
-                        // write the text
-                        sb_draw_text(sam_bar, FONT_HEIGHT, stdin_string);
-                        y -= 4 * FONT_HEIGHT + 5 * LINE_PADDING;
-                        sb_draw_text(sam_bar, y, time_string);
-                        y -= 3 * FONT_HEIGHT + 2 * LINE_PADDING;
-                        sb_draw_text(sam_bar, y, volume_string);
-                        y -= 3 * FONT_HEIGHT + 2 * LINE_PADDING;
-                        if (battery_string[10] != '\0') {
-                                y -= FONT_HEIGHT + LINE_PADDING;
-                        }
-                        sb_draw_text(sam_bar, y, battery_string);
-                        y -= 3 * FONT_HEIGHT + 2 * LINE_PADDING;
-                        sb_draw_text(sam_bar, y, light_string);
-                        y -= 1 * FONT_HEIGHT + 1 * LINE_PADDING;
-                        sb_draw_text(sam_bar, y, recording_string);
-                        xcb_flush(sam_bar->connection);
-                }
-                redraw = false;
+                // waiting on replies can queue X events without the fd
+                // ever becoming readable again
+                if (sb_loop_read_x(sam_bar))
+                        sb_loop_draw(sam_bar, &loop.state);
         }
 
         // relinquish loop resources
-        sb_kill(&pactl_info);
+        sb_kill(&loop.pactl_info);
+        close(loop.network_info.query_fd);
+        close(loop.network_info.event_fd);
+        close(loop.load_info.stat_fd);
+        close(loop.load_info.meminfo_fd);
+        close(pollfds[SB_POLL_SIGNAL].fd);
 }
 
-int main(void) {
+int main(int argc, char **argv) {
         struct sam_bar sam_bar;
+        FILE *record = NULL, *replay = NULL;
+        struct latency_probe probe;
+        int use_probe = false, use_shm = false;
+
+        sb_config_default_path(sam_bar.config_path);
+
+        { // -r FILE records a trace of every event, -p FILE replays one,
+          // -l measures event to vblank latency, -c FILE picks the config,
+          // -s renders client side into MIT-SHM instead of using XRender
+                const char *record_path = NULL, *replay_path = NULL;
+                int opt;
+                while ((opt = getopt(argc, argv, "r:p:lc:s")) != -1) {
+                        switch (opt) {
+                        case 's':
+                                use_shm = true;
+                                break;
+                        case 'c':
+                                snprintf(
+                                        sam_bar.config_path,
+                                        sizeof sam_bar.config_path,
+                                        "%s", optarg
+                                );
+                                break;
+                        case 'l':
+                                use_probe = true;
+                                break;
+                        case 'r':
+                                record_path = optarg;
+                                break;
+                        case 'p':
+                                replay_path = optarg;
+                                break;
+                        default:
+                                fprintf(stderr, "usage: %s [-c config] [-l] [-s] [-r trace | -p trace]\n", argv[0]);
+                                return EXIT_FAILURE;
+                        }
+                }
+
+                // only open the files once the options make sense,
+                // so a bad command line never truncates a trace
+                if (record_path != NULL && replay_path != NULL) {
+                        fprintf(stderr, "-r and -p can't be used together\n");
+                        return EXIT_FAILURE;
+                }
+                if (record_path != NULL) {
+                        record = fopen(record_path, "wb");
+                        if (record == NULL) {
+                                perror(record_path);
+                                return EXIT_FAILURE;
+                        }
+                        fwrite(SB_TRACE_MAGIC, sizeof SB_TRACE_MAGIC, 1, record);
+                }
+                if (replay_path != NULL) {
+                        replay = fopen(replay_path, "rb");
+                        if (replay == NULL) {
+                                perror(replay_path);
+                                return EXIT_FAILURE;
+                        }
+                }
+        }
 
         { // initialize most of the xcb stuff sam_bar
                 int ptr[] = { SCREEN_NUMBER };
@@ -614,22 +2613,20 @@ int main(void) {
                 sam_bar.screen = xcb_setup_roots_iterator(
                         xcb_get_setup(sam_bar.connection)
                 ).data;
+                sb_config_load(&sam_bar.config, sam_bar.config_path, NULL);
                 sam_bar.height = sam_bar.screen->height_in_pixels;
-                sam_bar.width = WIDTH;
+                sam_bar.width = sam_bar.config.width;
                 sam_bar.window = xcb_generate_id(sam_bar.connection);
                 sam_bar.picture = xcb_generate_id(sam_bar.connection);
+                sam_bar.target = sam_bar.window;
+                sam_bar.target_picture = sam_bar.picture;
                 sam_bar.colormap = xcb_generate_id(sam_bar.connection);
                 sam_bar.visual_id = xcb_aux_find_visual_by_attrs(
                         sam_bar.screen, 
                         -1, 
                         32
                 )->visual_id;
-                for (int i = 0; i < SB_PEN_MAX; i++) {
-                        sam_bar.pens[i] = xcbft_create_pen(
-                                sam_bar.connection,
-                                SB_PEN_COLOR[i]
-                        );
-                }
+                sb_create_pens(&sam_bar);
         }
 
         // initialize a 32 bit colormap
@@ -640,39 +2637,25 @@ int main(void) {
                 sam_bar.visual_id
         );
 
-        { // load up fonts and glyphs
-                FcStrSet *fontsearch;
-                struct xcbft_patterns_holder font_patterns;
-                struct utf_holder chars;
-
-                xcbft_init();
-                fontsearch = xcbft_extract_fontsearch_list(FONT_STRING);
-                font_patterns = xcbft_query_fontsearch_all(fontsearch);
-                FcStrSetDestroy(fontsearch);
-                sam_bar.face_holder = xcbft_load_faces(font_patterns, DPI);
-                xcbft_patterns_holder_destroy(font_patterns);
-                chars = char_to_uint32(CHARS);
-                sam_bar.glyphset = xcbft_load_glyphset(
-                                sam_bar.connection,
-                                sam_bar.face_holder,
-                                chars,
-                                DPI
-                ).glyphset;
-                utf_holder_destroy(chars);
-        }
+        // load up fonts and glyphs
+        xcbft_init();
+        sb_load_font(&sam_bar);
 
         { // initialize window
                 xcb_void_cookie_t cookie;
                 int mask = XCB_CW_BACK_PIXEL
                         | XCB_CW_BORDER_PIXEL
                         | XCB_CW_OVERRIDE_REDIRECT
+                        | XCB_CW_EVENT_MASK
                         | XCB_CW_COLORMAP;
                 // we have a 32 bit visual/colormap, su just use ARGB colors
-                int values[4];
-                values[0] = BACKGROUND_COLOR;
+                int values[5];
+                values[0] = sam_bar.config.background;
                 values[1] = 0xFFFFFFFF;
                 values[2] = true;
-                values[3] = sam_bar.colormap;
+                // redraw when something that covered the bar goes away
+                values[3] = XCB_EVENT_MASK_EXPOSURE;
+                values[4] = sam_bar.colormap;
 
                 cookie = xcb_create_window_checked(
                         sam_bar.connection,
@@ -757,29 +2740,35 @@ int main(void) {
 
         );
 
-        {
-                // setup struts so windows don't overlap the bar
-                int struts[STRUTS_NUM_ARGS] = {0};
-                struts[LEFT] = sam_bar.width;
-                struts[LEFT_START_Y] = struts[RIGHT_START_Y] = 0;
-                struts[LEFT_END_Y] = struts[RIGHT_END_Y] = sam_bar.height;
-                struts[TOP_START_X] = struts[BOTTOM_START_X] = 0;
-                struts[TOP_END_X] = struts[BOTTOM_END_X] = sam_bar.width;
-                xcb_change_property(
-                        sam_bar.connection,
-                        XCB_PROP_MODE_REPLACE,
-                        sam_bar.window,
-                        sam_bar.atoms[NET_WM_STRUT_PARTIAL],
-                        XCB_ATOM_CARDINAL,
-                        32, // MAGIC NUMBER ?
-                        STRUTS_NUM_ARGS, struts
-                );
-        }
+        sb_set_struts(&sam_bar);
+
+        sam_bar.shm = NULL;
+        sam_bar.probe = NULL;
+        if (use_shm && !sb_shm_init(&sam_bar))
+                fprintf(stderr, "MIT-SHM unavailable, falling back on XRender\n");
 
         xcb_flush(sam_bar.connection);
-        sb_loop_main(&sam_bar);
+        if (replay != NULL) {
+                sb_loop_replay(&sam_bar, replay);
+                fclose(replay);
+        } else {
+                if (use_probe && !sb_probe_init(&probe, &sam_bar)) {
+                        fprintf(stderr, "no Present extension, not probing latency\n");
+                        use_probe = false;
+                }
+                sam_bar.probe = use_probe ? &probe : NULL;
+                sb_loop_main(&sam_bar, record);
+                if (use_probe) {
+                        sb_probe_report(&probe, stdout);
+                        sb_probe_destroy(&probe, &sam_bar);
+                }
+                if (record != NULL)
+                        fclose(record);
+        }
 
         // relinquish resources
+        if (sam_bar.shm != NULL)
+                sb_shm_destroy(&sam_bar);
         for (int i = 0; i < SB_PEN_MAX; i++) {
                 xcb_render_free_picture(sam_bar.connection, sam_bar.pens[i]);
         }
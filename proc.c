@@ -0,0 +1,81 @@
+#include <string.h>
+#include <unistd.h>
+
+#include "proc.h"
+
+/*
+ * Skips the spaces at *str, then parses the number after them,
+ * leaving *str pointing just past it
+ */
+unsigned long long sb_scan_ull(const char **str) {
+        const char *c = *str;
+        unsigned long long n = 0;
+
+        while (*c == ' ')
+                c++;
+        while (sb_is_numeric(*c))
+                n = n * 10 + *(c++) - '0';
+        *str = c;
+        return n;
+}
+
+/*
+ * pread the start of fd into buffer and null terminate it
+ * Returns 0 if nothing could be read
+ */
+int sb_pread_start(int fd, char *buffer, size_t size) {
+        ssize_t len = pread(fd, buffer, size - 1, 0);
+        if (len <= 0)
+                return 0;
+        buffer[len] = '\0';
+        return 1;
+}
+
+/*
+ * Scans the aggregate "cpu" line, which is always the first line of
+ * /proc/stat, so the per-cpu lines are never looked at
+ * Assumptions:
+ * - stat starts with "cpu  user nice system idle iowait irq softirq steal"
+ */
+void sb_parse_stat(const char *stat,
+                unsigned long long *busy, unsigned long long *total) {
+        unsigned long long field;
+
+        stat += sizeof("cpu") - 1;
+        *busy = *total = 0;
+        for (int i = 0; i < 8; i++) {
+                field = sb_scan_ull(&stat);
+                *total += field;
+                // idle and iowait
+                if (i != 3 && i != 4)
+                        *busy += field;
+        }
+}
+
+/*
+ * Scans /proc/meminfo up to MemAvailable, which is the third line
+ * Returns the percentage of memory in use
+ */
+int sb_parse_meminfo(const char *meminfo) {
+        unsigned long long mem_total = 0, mem_available = 0;
+
+        for (; *meminfo != '\0'; meminfo++) {
+                if (strncmp(meminfo, "MemTotal:", sizeof("MemTotal:") - 1) == 0) {
+                        meminfo += sizeof("MemTotal:") - 1;
+                        mem_total = sb_scan_ull(&meminfo);
+                } else if (strncmp(meminfo, "MemAvailable:", sizeof("MemAvailable:") - 1) == 0) {
+                        meminfo += sizeof("MemAvailable:") - 1;
+                        mem_available = sb_scan_ull(&meminfo);
+                        break;
+                }
+                // skip to the end of the line
+                while (*meminfo != '\n' && *meminfo != '\0')
+                        meminfo++;
+                if (*meminfo == '\0')
+                        break;
+        }
+
+        if (mem_total == 0 || mem_available > mem_total)
+                return 0;
+        return 100 * (mem_total - mem_available) / mem_total;
+}
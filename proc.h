@@ -0,0 +1,19 @@
+#ifndef SB_PROC_H
+#define SB_PROC_H
+
+#include <stddef.h>
+
+/*
+ * Hand written scanners for the few /proc fields the load segment needs;
+ * kept apart from main.c so they can be benchmarked without X
+ */
+
+#define sb_is_numeric(c)  (((c) ^ '0') < 10)
+
+unsigned long long sb_scan_ull(const char **str);
+int sb_pread_start(int fd, char *buffer, size_t size);
+void sb_parse_stat(const char *stat,
+                unsigned long long *busy, unsigned long long *total);
+int sb_parse_meminfo(const char *meminfo);
+
+#endif